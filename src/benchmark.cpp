@@ -0,0 +1,245 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <cstdlib>
+#include <new>
+#include "position.h"
+#include "engine.h"
+#include "benchmark.h"
+
+// allocations of the current thread, counted by the replaced operator new
+thread_local uint64_t allocation_count = 0;
+
+// The global operator new is replaced only in builds for measuring (g++ -DCOUNT_ALLOCATIONS ...),
+// so that the other modes do not run through the counting allocator
+#ifdef COUNT_ALLOCATIONS
+void* operator new(size_t size){
+    allocation_count++;
+    void* result = malloc(size == 0 ? 1 : size);
+    if(result == nullptr){
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void* operator new[](size_t size){
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept{
+    free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept{
+    free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept{
+    free(pointer);
+}
+#endif
+
+namespace Benchmark{
+
+    // fixed part of the corpus
+    const std::vector<std::string> CORPUS_FENS = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "8/8/8/4k3/8/8/3QK3/8 w - - 0 1",
+        "r5rk/5p1p/5R2/4B3/8/8/7P/7K w - - 0 1",
+    };
+
+    // result of the optimizer-proof sink, printed nowhere
+    volatile size_t sink = 0;
+
+    /**
+     * @brief returns number of allocations (calls of operator new) done by the current thread since the start of the program
+     * (always 0 unless compiled with COUNT_ALLOCATIONS, see Benchmark::COUNTS_ALLOCATIONS)
+     */
+    uint64_t allocations(){
+        return allocation_count;
+    }
+
+    /**
+     * @brief returns the positions used by the micro-benchmarks: fixed positions (opening, middlegame and endgame)
+     * followed by positions of generated puzzles and their solutions (puzzles are generated with seeds "microbench_0", "microbench_1", ...)
+     */
+    std::vector<Position> get_corpus(int puzzles){
+        auto corpus = std::vector<Position>();
+        for(auto& fen : CORPUS_FENS){
+            corpus.push_back(Position(fen));
+        }
+        auto cache = Cache();
+        for(int i = 0; i < puzzles; i++){
+            int max_moves = 2;
+            Position puzzle = Engine::generate_puzzle_by_playing(&cache, max_moves, false, "microbench_" + std::to_string(i));
+            corpus.push_back(puzzle);
+            for(auto m : Engine::get_principal_variation(&puzzle, 2 * max_moves - 1, &cache)){
+                puzzle.perform_move(m);
+                corpus.push_back(puzzle);
+            }
+        }
+        return corpus;
+    }
+
+    /**
+     * @brief repeats the operation (applied to every position of the corpus) for at least min_time seconds
+     * and writes the result as JSON line
+     *
+     * @param operation performs the operation on the position and returns the number of operations performed
+     */
+    template<typename Operation>
+    void measure(std::ostream& output, const std::string& name, std::vector<Position>& corpus, double min_time, Operation operation){
+        uint64_t operations = 0;
+        uint64_t start_allocations = allocations();
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while(elapsed < min_time){
+            for(auto& position : corpus){
+                operations += operation(position);
+            }
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        uint64_t allocated = allocations() - start_allocations;
+        output << "{\"benchmark\":\"" << name << "\""
+            << ",\"positions\":" << corpus.size()
+            << ",\"operations\":" << operations
+            << ",\"ns_per_op\":" << elapsed * 1e9 / operations;
+        if(COUNTS_ALLOCATIONS){
+            output << ",\"allocs_per_op\":" << (double)allocated / operations;
+        }
+        output << "}" << std::endl;
+    }
+
+    /**
+     * @brief Times hot functions of Position (get_possible_moves, get_checking_moves, perform_move/undo_move, square_hit, get_hash, get_fen, FEN parsing)
+     * over the corpus (see Benchmark::get_corpus).
+     *
+     * Writes one JSON line per function with the number of operations, nanoseconds per operation and allocations per operation
+     * (only if compiled with COUNT_ALLOCATIONS).
+     *
+     * @param min_time every function is repeated over the corpus for at least min_time seconds
+     */
+    void run_micro(std::ostream& output, std::vector<Position>& corpus, double min_time){
+        // moves and FENs are prepared in advance, so that only the measured function is timed
+        auto moves = std::vector<std::vector<Move>>();
+        auto fens = std::vector<std::string>();
+        for(auto& position : corpus){
+            moves.push_back(position.get_possible_moves());
+            fens.push_back(position.get_fen());
+        }
+        auto index = [&](Position& position){ return &position - corpus.data(); };
+
+        measure(output, "get_possible_moves", corpus, min_time, [&](Position& position){
+            sink = sink + position.get_possible_moves().size();
+            return 1;
+        });
+        measure(output, "get_checking_moves", corpus, min_time, [&](Position& position){
+            sink = sink + position.get_checking_moves().size();
+            return 1;
+        });
+        // one operation is a move performed and undone
+        measure(output, "perform_undo_move", corpus, min_time, [&](Position& position){
+            auto& position_moves = moves[index(position)];
+            for(auto m : position_moves){
+                position.perform_move(m);
+                position.undo_move();
+            }
+            return position_moves.size();
+        });
+        // one operation is one query for one square and one side
+        measure(output, "square_hit", corpus, min_time, [&](Position& position){
+            size_t hits = 0;
+            for(int square = 0; square < 64; square++){
+                hits += position.square_hit(square, true) + position.square_hit(square, false);
+            }
+            sink = sink + hits;
+            return 128;
+        });
+        measure(output, "get_hash", corpus, min_time, [&](Position& position){
+            sink = sink + position.get_hash();
+            return 1;
+        });
+        measure(output, "get_fen", corpus, min_time, [&](Position& position){
+            sink = sink + position.get_fen().size();
+            return 1;
+        });
+        Position parsed;
+        measure(output, "parse_fen", corpus, min_time, [&](Position& position){
+            sink = sink + (size_t)parse_fen(fens[index(position)], &parsed);
+            return 1;
+        });
+    }
+
+    /**
+     * @brief Generates puzzles (see Engine::generate_puzzle_by_playing) for fixed seeds "bench_0", "bench_1", ... and every given
+     * maximal number of moves, each with an empty cache, so that the puzzles do not depend on the order of generation.
+     *
+     * Writes the total time, percentiles of the time per puzzle, searched nodes and the checksum of FENs of the puzzles
+     * (equal checksums mean the same puzzles), the statistics per iteration of the search for the fastest mate of the puzzles
+     * (see Engine::SearchStats, summed over the puzzles, not included in the time and nodes of the generation),
+     * followed by the statistics of the generation as JSON line (see Engine::write_statistics_json)
+     */
+    void run_generation(std::ostream& output, int seeds, const std::vector<int>& max_moves){
+        Engine::statistics = Engine::Statistics();
+        auto latencies = std::vector<double>();
+        auto puzzles = std::vector<std::pair<Position, int>>();
+        // FNV-1a hash of all FENs (each followed by a newline)
+        uint64_t checksum = 14695981039346656037ull;
+        auto start = std::chrono::steady_clock::now();
+        for(int moves : max_moves){
+            for(int i = 0; i < seeds; i++){
+                auto puzzle_start = std::chrono::steady_clock::now();
+                auto cache = Cache();
+                Position puzzle = Engine::generate_puzzle_by_playing(&cache, moves, false, "bench_" + std::to_string(i));
+                latencies.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - puzzle_start).count());
+                puzzles.push_back({puzzle, moves});
+                for(char c : puzzle.get_fen() + "\n"){
+                    checksum = (checksum ^ (uint8_t)c) * 1099511628211ull;
+                }
+            }
+        }
+        double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // nearest-rank percentiles
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](int p){
+            if(latencies.empty()){
+                return 0.0;
+            }
+            size_t rank = (p * latencies.size() + 99) / 100;
+            return latencies[std::max<size_t>(rank, 1) - 1];
+        };
+        output << "puzzles: " << latencies.size() << std::endl;
+        output << "total time: " << total << " s" << std::endl;
+        output << "latency p50: " << percentile(50) << " s, p90: " << percentile(90) << " s, p99: " << percentile(99)
+            << " s, max: " << percentile(100) << " s" << std::endl;
+        output << "nodes: " << Engine::statistics.nodes << " (" << (total > 0 ? Engine::statistics.nodes / total : 0) << " nps)" << std::endl;
+        output << "checksum: " << std::hex << std::setw(16) << std::setfill('0') << checksum << std::dec << std::setfill(' ') << std::endl;
+
+        // the puzzles are searched again with statistics per iteration, after the statistics of the generation are taken
+        auto generation_statistics = Engine::statistics;
+        Engine::SearchStats search_stats;
+        for(auto& puzzle : puzzles){
+            auto cache = Cache();
+            Engine::clear_killers();
+            Engine::SearchStats puzzle_stats;
+            Engine::find_fastest_mate(&puzzle.first, puzzle.second, &cache, &puzzle_stats);
+            search_stats.add(puzzle_stats);
+        }
+        output << "fastest mate search of the puzzles:" << std::endl << search_stats.to_string();
+        Engine::write_statistics_json(output, generation_statistics, total);
+    }
+
+}
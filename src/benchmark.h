@@ -0,0 +1,52 @@
+#pragma once
+
+#include "position.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Benchmark{
+
+    // true if the program counts the allocations (compiled with -DCOUNT_ALLOCATIONS)
+#ifdef COUNT_ALLOCATIONS
+    const bool COUNTS_ALLOCATIONS = true;
+#else
+    const bool COUNTS_ALLOCATIONS = false;
+#endif
+
+    /**
+     * @brief returns number of allocations (calls of operator new) done by the current thread since the start of the program
+     * (always 0 unless compiled with COUNT_ALLOCATIONS, see Benchmark::COUNTS_ALLOCATIONS)
+     */
+    uint64_t allocations();
+
+    /**
+     * @brief returns the positions used by the micro-benchmarks: fixed positions (opening, middlegame and endgame)
+     * followed by positions of generated puzzles and their solutions (puzzles are generated with seeds "microbench_0", "microbench_1", ...)
+     */
+    std::vector<Position> get_corpus(int puzzles);
+
+    /**
+     * @brief Times hot functions of Position (get_possible_moves, get_checking_moves, perform_move/undo_move, square_hit, get_hash, get_fen, FEN parsing)
+     * over the corpus (see Benchmark::get_corpus).
+     *
+     * Writes one JSON line per function with the number of operations, nanoseconds per operation and allocations per operation
+     * (only if compiled with COUNT_ALLOCATIONS).
+     *
+     * @param min_time every function is repeated over the corpus for at least min_time seconds
+     */
+    void run_micro(std::ostream& output, std::vector<Position>& corpus, double min_time=0.5);
+
+    /**
+     * @brief Generates puzzles (see Engine::generate_puzzle_by_playing) for fixed seeds "bench_0", "bench_1", ... and every given
+     * maximal number of moves, each with an empty cache, so that the puzzles do not depend on the order of generation.
+     *
+     * Writes the total time, percentiles of the time per puzzle, searched nodes and the checksum of FENs of the puzzles
+     * (equal checksums mean the same puzzles), the statistics per iteration of the search for the fastest mate of the puzzles
+     * (see Engine::SearchStats, summed over the puzzles, not included in the time and nodes of the generation),
+     * followed by the statistics of the generation as JSON line (see Engine::write_statistics_json)
+     */
+    void run_generation(std::ostream& output, int seeds, const std::vector<int>& max_moves);
+
+}
@@ -0,0 +1,157 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "position.h"
+#include "dedup.h"
+
+// Dedup file is the magic followed by the number of keys and sorted keys
+const char DEDUP_MAGIC[8] = {'T', 'A', 'C', 'T', 'S', 'E', 'E', 'N'};
+
+// Number of bits set in the bloom filter for every key
+const int BLOOM_HASHES = 6;
+
+// Bits of the bloom filter per key, gives about 2% false positives
+const int BLOOM_BITS_PER_KEY = 8;
+
+// Maximal size of DedupIndex::m_recent
+const size_t RECENT_CAPACITY = 1024;
+
+/**
+ * @brief returns key of the position, which is the same for all symmetric positions (colors swapped and/or files mirrored,
+ * see Position::get_symmetric_hash), so that puzzles equivalent by symmetry have the same key
+ *
+ * All four keys (the identity included) are computed by Position::get_symmetric_hash from the same content (pieces,
+ * en-passant square and player to move, without castling rights), so the images of a position cannot differ
+ * in a part which only some of the keys cover.
+ */
+uint64_t canonical_key(Position* position){
+    uint64_t key = UINT64_MAX;
+    for(bool flip_colors : {false, true}){
+        for(bool mirror_files : {false, true}){
+            key = std::min<uint64_t>(key, position->get_symmetric_hash(flip_colors, mirror_files));
+        }
+    }
+    return key;
+}
+
+/**
+ * @brief Construct empty index (nothing is loaded or saved)
+ */
+DedupIndex::DedupIndex(){
+    rebuild_bloom();
+}
+
+/**
+ * @brief Construct the index stored in the file (if the file does not exist, the index is empty)
+ *
+ * @throws const char* if the file is not a dedup index
+ */
+DedupIndex::DedupIndex(const std::string& path){
+    m_path = path;
+    std::ifstream file(path, std::ios::binary);
+    if(file){
+        char magic[8];
+        uint64_t count = 0;
+        file.read(magic, sizeof(magic));
+        file.read((char*)&count, sizeof(count));
+        if(!file || memcmp(magic, DEDUP_MAGIC, sizeof(magic)) != 0){
+            throw "invalid dedup index file";
+        }
+        m_keys.resize(count);
+        file.read((char*)m_keys.data(), count * sizeof(uint64_t));
+        if(!file || !std::is_sorted(m_keys.begin(), m_keys.end())){
+            throw "invalid dedup index file";
+        }
+    }
+    rebuild_bloom();
+}
+
+// returns true if the key was added to the index
+bool DedupIndex::contains(uint64_t key){
+    // bits of the key are derived by double hashing from the two halves of the key
+    uint64_t step = (key >> 32) | 1;
+    uint64_t mask = m_bloom.size() * 64 - 1;
+    for(int i = 0; i < BLOOM_HASHES; i++){
+        uint64_t bit = (key + i * step) & mask;
+        if((m_bloom[bit / 64] & ((uint64_t)1 << (bit % 64))) == 0){
+            return false;
+        }
+    }
+    return std::binary_search(m_keys.begin(), m_keys.end(), key)
+        || std::find(m_recent.begin(), m_recent.end(), key) != m_recent.end();
+}
+
+// adds the key to the index
+void DedupIndex::insert(uint64_t key){
+    if(contains(key)){
+        return;
+    }
+    m_recent.push_back(key);
+    if(m_recent.size() >= RECENT_CAPACITY){
+        std::sort(m_recent.begin(), m_recent.end());
+        size_t middle = m_keys.size();
+        m_keys.insert(m_keys.end(), m_recent.begin(), m_recent.end());
+        std::inplace_merge(m_keys.begin(), m_keys.begin() + middle, m_keys.end());
+        m_recent.clear();
+    }
+    if(size() * BLOOM_BITS_PER_KEY > m_bloom.size() * 64){
+        rebuild_bloom();
+    } else {
+        add_to_bloom(key);
+    }
+}
+
+// returns number of keys
+size_t DedupIndex::size(){
+    return m_keys.size() + m_recent.size();
+}
+
+/**
+ * @brief writes the keys into the file given in constructor (does nothing for index without a file)
+ *
+ * @throws const char* if the file cannot be written
+ */
+void DedupIndex::save(){
+    if(m_path.empty()){
+        return;
+    }
+    auto keys = m_keys;
+    keys.insert(keys.end(), m_recent.begin(), m_recent.end());
+    std::sort(keys.begin(), keys.end());
+    uint64_t count = keys.size();
+    std::ofstream file(m_path, std::ios::binary | std::ios::trunc);
+    file.write(DEDUP_MAGIC, sizeof(DEDUP_MAGIC));
+    file.write((const char*)&count, sizeof(count));
+    file.write((const char*)keys.data(), count * sizeof(uint64_t));
+    if(!file){
+        throw "cannot write dedup index file";
+    }
+}
+
+// sets the bits of the key in the bloom filter
+void DedupIndex::add_to_bloom(uint64_t key){
+    uint64_t step = (key >> 32) | 1;
+    uint64_t mask = m_bloom.size() * 64 - 1;
+    for(int i = 0; i < BLOOM_HASHES; i++){
+        uint64_t bit = (key + i * step) & mask;
+        m_bloom[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+// rebuilds the bloom filter with enough bits for the current number of keys
+void DedupIndex::rebuild_bloom(){
+    size_t words = 1024;
+    while(words * 64 < 2 * size() * BLOOM_BITS_PER_KEY){
+        words *= 2;
+    }
+    m_bloom.assign(words, 0);
+    for(auto key : m_keys){
+        add_to_bloom(key);
+    }
+    for(auto key : m_recent){
+        add_to_bloom(key);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "position.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief returns key of the position, which is the same for all symmetric positions (colors swapped and/or files mirrored,
+ * see Position::get_symmetric_hash), so that puzzles equivalent by symmetry have the same key
+ */
+uint64_t canonical_key(Position* position);
+
+/**
+ * @brief Persistent set of keys of already generated puzzles (see canonical_key).
+ *
+ * Keys are stored in a sorted vector (8 bytes per key), recently added keys in a small unsorted buffer.
+ * A bloom filter in front of the set answers most lookups of unknown keys without searching the set.
+ * The keys are saved to and loaded from a binary file, so that the puzzles are not repeated across runs.
+ */
+class DedupIndex{
+
+    public:
+
+        /**
+         * @brief Construct empty index (nothing is loaded or saved)
+         */
+        DedupIndex();
+
+        /**
+         * @brief Construct the index stored in the file (if the file does not exist, the index is empty)
+         *
+         * @throws const char* if the file is not a dedup index
+         */
+        DedupIndex(const std::string& path);
+
+        // returns true if the key was added to the index
+        bool contains(uint64_t key);
+
+        // adds the key to the index
+        void insert(uint64_t key);
+
+        // returns number of keys
+        size_t size();
+
+        /**
+         * @brief writes the keys into the file given in constructor (does nothing for index without a file)
+         *
+         * @throws const char* if the file cannot be written
+         */
+        void save();
+
+    private:
+        std::string m_path;
+
+        // sorted keys
+        std::vector<uint64_t> m_keys;
+
+        // recently added keys, merged into m_keys when the buffer is full
+        std::vector<uint64_t> m_recent;
+
+        // bloom filter of all keys, its size is a power of two
+        std::vector<uint64_t> m_bloom;
+
+        // sets the bits of the key in the bloom filter
+        void add_to_bloom(uint64_t key);
+
+        // rebuilds the bloom filter with enough bits for the current number of keys
+        void rebuild_bloom();
+};
@@ -1,13 +1,35 @@
 #include <map>
 #include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <memory>
 #include "position.h"
 #include "engine.h"
+#include "tablebase.h"
+#include "move_picker.h"
 
-#define Cache std::unordered_map<size_t, std::pair<int, int>>
+#define Cache std::unordered_map<size_t, Engine::CacheEntry>
 
 namespace Engine{
 
+    // killer moves of the search of the current thread
+    thread_local KillerTable killers;
+
+    // number of evaluations of the current thread which depended on the path to the position (repetitions and fifty-move rule),
+    // a mate found in a subtree containing such evaluation holds only for the current path
+    thread_local uint64_t path_dependent_evals = 0;
+
+    // number of extended searches of the current thread (see Engine::evaluate), a mate longer than the searched depth found
+    // in a subtree containing an extension may not be the fastest one
+    thread_local uint64_t extended_searches = 0;
+
+    // limits of the searches of the current thread (see Engine::SearchScope)
+    thread_local SearchControl search_control;
+
+    // packed move searched first at the root of the search of the current thread instead of the cached move, 0 for none
+    // (see Engine::undo_and_evaluate), it only orders the moves and nothing is stored for it
+    thread_local uint16_t root_move_hint = 0;
+
     /**
      * @brief Worsen eval by 1 every turn so that engine chooses fastest mate
      * 
@@ -26,26 +48,106 @@ namespace Engine{
     }
 
     /**
-     * @brief Get the evaluation guess, used for ordering search in alfa/beta search
+     * @brief Inverse of Engine::process_eval. Used to shift alfa/beta window to the child position
      * 
-     * @return int previous evaluation of the position of longest depth or 0 if there is no information in the cache
      */
-    int get_eval_guess(size_t hash, Cache* cache){
-        auto cached_result = cache->find(hash);
-        if(cached_result != cache->end()){
-            return cached_result->second.second;
+    int unprocess_eval(int num){
+        if(abs(num) < MATE_THRESHOLD - 1){
+            return num;
+        } else if(num > 0){
+            return num + 1;
         } else {
-            return 0;
+            return num - 1;
         }
     }
 
+    /**
+     * @brief forgets the killer moves of the current thread (see Engine::KillerTable), so that the next search does not depend on the previous ones
+     */
+    void clear_killers(){
+        killers = KillerTable();
+    }
+
+    // stops the searches as soon as they check the token
+    void CancellationToken::cancel(){
+        cancelled = true;
+    }
+
+    bool CancellationToken::is_cancelled() const{
+        return cancelled;
+    }
+
+    // returns true if any token of the chain is cancelled
+    static bool cancelled(const CancelChain* chain){
+        for(; chain != nullptr; chain = chain->outer){
+            if(chain->token->is_cancelled()){
+                return true;
+            }
+        }
+        return false;
+    }
 
     /**
-     * @brief Comparator used to sort std::vector<std::pair<int, Move>> in descending order
+     * @brief stops the searches of the current thread if a limit of the current scope is exceeded. The nodes are checked every node,
+     * the clock and the cancellation token only every 1024 nodes (unless forced), so that the check is cheap
+     */
+    void check_search_limits(bool force){
+        if(search_control.node_limit != 0 && statistics.nodes >= search_control.node_limit){
+            search_control.stopped = true;
+        } else if(force || (statistics.nodes & 1023) == 0){
+            if((search_control.has_deadline && std::chrono::steady_clock::now() >= search_control.deadline)
+                || cancelled(search_control.cancel)){
+                search_control.stopped = true;
+            }
+        }
+    }
+
+    SearchScope::SearchScope(const SearchLimits& limits){
+        m_outer = search_control;
+        if(limits.time > 0){
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(limits.time));
+            if(!search_control.has_deadline || deadline < search_control.deadline){
+                search_control.deadline = deadline;
+            }
+            search_control.has_deadline = true;
+        }
+        if(limits.nodes > 0 && (search_control.node_limit == 0 || statistics.nodes + limits.nodes < search_control.node_limit)){
+            search_control.node_limit = statistics.nodes + limits.nodes;
+        }
+        if(limits.cancel != nullptr){
+            m_cancel = {limits.cancel, search_control.cancel};
+            search_control.cancel = &m_cancel;
+        }
+        search_control.active = search_control.has_deadline || search_control.node_limit != 0 || search_control.cancel != nullptr;
+    }
+
+    SearchScope::~SearchScope(){
+        search_control = m_outer;
+        if(search_control.active){
+            // the outer limits may have been exceeded during the scope
+            check_search_limits(true);
+        }
+    }
+
+    /**
+     * @brief returns true if the searches of the current thread were stopped by the limits of the current scope (see Engine::SearchScope)
+     */
+    bool search_stopped(){
+        return search_control.stopped;
+    }
+
+    /**
+     * @brief Get the evaluation guess, used for ordering search in alfa/beta search
      * 
+     * @return int previous evaluation of the position of longest depth or 0 if there is no information in the cache
      */
-    bool sort_moves(const std::pair<int,Move> a, std::pair<int,Move> b){
-        return (a.first > b.first);
+    int get_eval_guess(size_t hash, Cache* cache){
+        auto cached_result = cache->find(hash);
+        if(cached_result != cache->end()){
+            return cached_result->second.eval;
+        } else {
+            return 0;
+        }
     }
 
     /**
@@ -56,86 +158,166 @@ namespace Engine{
      * 
      * @param maxdepth maximal depth in halfmoves to search the position
      * 
-     * @param cache previous evaluations stored in hashmap. The elements are stored ad std::pair<int, int>.
-     * Where element.first is evaluation depth and element.second is the evaluation
+     * @param cache previous evaluations stored in hashmap. The elements are stored as Engine::CacheEntry
+     * (evaluation depth, the evaluation and whether it is exact or only a bound)
+     * 
+     * @param ply distance from the root of the search. Positions repeated in the game history (or drawn by fifty-move rule)
+     * are evaluated as draw everywhere except the root
+     *
+     * @param extensions number of half-moves by which the line can still be extended. A position in check with only one
+     * legal move is searched two half-moves deeper, so forced lines are searched beyond maxdepth
      */
-    int evaluate(Position* position, int maxdepth, Cache* cache, int alfa, int beta){
+    int evaluate(Position* position, int maxdepth, Cache* cache, int alfa, int beta, int ply, int extensions){
+        if(search_control.stopped){
+            // the search was stopped by its limits, the evaluation is not used
+            return 0;
+        }
+        int side = position->m_to_move == 'w' ? 1 : -1;
+        if(ply > 0){
+            if(position->repetitions() > 0){
+                // Repeating a position cannot be better than a draw, this also cuts all cycles in the search tree.
+                // The result depends on the path to the position, thus it is not cached
+                path_dependent_evals++;
+                return 0;
+            }
+            // Mate distance pruning: the player to move cannot do better than mate by the next move, nor worse than being mated now.
+            // Evaluations are relative to the position, so a shorter mate found elsewhere in the tree shifts the window out of these limits
+            alfa = std::max(alfa, -MATE);
+            beta = std::min(beta, MATE - 1);
+            if(alfa >= beta){
+                return alfa * side;
+            }
+        }
+        statistics.nodes++;
+        statistics.max_ply = std::max(statistics.max_ply, ply);
+        if(search_control.active){
+            check_search_limits(false);
+            if(search_control.stopped){
+                return 0;
+            }
+        }
         size_t hash = position->get_hash();
+        uint64_t path_dependent = path_dependent_evals;
+        uint64_t extended = extended_searches;
+        if(extensions >= 2 && position->in_check() && position->count_legal_moves(2) == 1){
+            // Check extension and single-reply extension: the only reply to a check is searched two half-moves deeper, so forced lines
+            // reach beyond maxdepth without widening the tree (extending every check makes the search several times slower).
+            // The extended depth is used in the cache as well
+            extended_searches++;
+            maxdepth += 2;
+            extensions -= 2;
+        }
         // Look if the position has been already evaluated
         auto cached_result = cache->find(hash);
-        if(cached_result != cache->end() && cached_result->second.first >= maxdepth){
-            // If the depth of evaluation is sufficient, return the stored value
-            return cached_result->second.second;
+        bool found = cached_result != cache->end();
+        uint16_t tt_move = found ? cached_result->second.move : 0;
+        if(ply == 0 && root_move_hint != 0){
+            tt_move = root_move_hint;
+        }
+        (found ? statistics.tt_hits : statistics.tt_misses)++;
+        if(found && cached_result->second.depth >= maxdepth){
+            // If the depth of evaluation is sufficient and the stored bound decides the result in the window, return the stored value
+            int value = cached_result->second.eval * side;
+            int bound = cached_result->second.bound * side;
+            if(bound == EXACT || (bound == LOWER_BOUND && value >= beta) || (bound == UPPER_BOUND && value <= alfa)){
+                if(abs(value) > MATE_THRESHOLD && MATE - abs(value) > maxdepth + 1){
+                    // the cached mate is longer than this search reaches (it was found thanks to extensions, by a deeper search
+                    // or in the tablebase), a line of the parent which was not searched so deep may mate faster
+                    extended_searches++;
+                }
+                return cached_result->second.eval;
+            }
         }
 
-        auto possible_moves = position->get_possible_moves();
-        int side = position->m_to_move == 'w' ? 1 : -1;
-        if(possible_moves.size() == 0){
+        if(!position->has_legal_moves()){
             // The position is either a mate or stalemate
-            auto king = position->m_pieces.find(position->m_to_move == 'w' ? 'K' : 'k');
-            if(position->square_hit(king->second, position->m_to_move != 'w')){
+            if(position->in_check()){
                 //mate
-                cache->insert({hash, {__INT_MAX__, -side * MATE}});
-                //for(auto m : position->m_prev_moves){std::cout << m.print() << " ";}; std::cout << "mate" << std::endl;
+                (*cache)[hash] = {__INT_MAX__, -side * MATE, EXACT};
                 return -side * MATE;
             } else { //stalemate
-                cache->insert({hash, {__INT_MAX__, 0}});
-                //for(auto m : position->m_prev_moves){std::cout << m.print() << " ";}; std::cout << "stalemate" << std::endl;
+                (*cache)[hash] = {__INT_MAX__, 0, EXACT};
                 return 0;
             }
+        } else if(position->m_halfmove_clock >= 100){
+            // fifty-move rule (mate on the last move is handled above), depends on the path, not cached
+            path_dependent_evals++;
+            return 0;
         } else if(position->m_pieces.size() <= 2){
             // only kings on board (to be precise, there should be also a case (K+N vs k) and (K+B vs k))
-            cache->insert({hash, {__INT_MAX__, 0}});
+            (*cache)[hash] = {__INT_MAX__, 0, EXACT};
             return 0;
+        } else if(position->m_pieces.size() <= Tablebase::MAX_PIECES){
+            // simple endgames are looked up in the tablebase (if it is loaded), which gives exact distance to mate
+            int plies;
+            auto result = Tablebase::probe(position, &plies);
+            if(result != Tablebase::Result::UNKNOWN){
+                int value = result == Tablebase::Result::DRAW ? 0 : (result == Tablebase::Result::WIN ? 1 : -1) * side * (MATE - plies);
+                (*cache)[hash] = {__INT_MAX__, value, EXACT};
+                if(value != 0 && plies > maxdepth + 1){
+                    // the mate is exact for this position, but it is longer than the search reaches, so the parent
+                    // may have a faster mate in a line which was not searched so deep (see the fastest mate rule below)
+                    extended_searches++;
+                }
+                return value;
+            }
         }
         if(maxdepth <= 0){
-            // No deeper evaluation, count the material
-            int result = 0;
-            for (auto p : position->m_pieces){
-                result += piece_values.find(p.first)->second;
-            }
-            if(cached_result != cache->end()){
-                cached_result->second = {maxdepth, result};
-            } else {
-                cache->insert({hash, {maxdepth, result}});
-            }
+            // No deeper evaluation, use the material count (updated incrementally by Position)
+            statistics.leaf_nodes++;
+            int result = position->m_material;
+            (*cache)[hash] = {maxdepth, result, EXACT};
             return result;
         }
         int eval = -MATE;
+        int original_alfa = alfa;
 
-        // Search order is important in alfa/beta pruned search. Guess the order by previous evaluation
-        auto ordered_moves = std::vector<std::pair<int, Move>>();
-        for(auto m : possible_moves){
-            position->perform_move(m);
-            int guess = get_eval_guess(position->get_hash(), cache);
-            position->undo_move();
-            ordered_moves.push_back({guess, m});
-        }
-        std::sort(ordered_moves.begin(), ordered_moves.end(), sort_moves);
+        // Search order is important in alfa/beta pruned search. The moves are generated in stages (see Engine::MovePicker),
+        // the best move of the previous search first
+        MovePicker picker(position, cache, tt_move, killers.get(ply));
+        Move m;
+        uint16_t best_move = 0;
 
         // Recursively evaluate positions with lower depth
-        for(auto pair : ordered_moves){
-            // try a move, evaluate and redo
-            position->perform_move(pair.second);
-            int new_eval = evaluate(position, maxdepth-1, cache, -beta, -alfa) * side;
+        bool first_move = true;
+        while(picker.next(&m)){
+            // try a move, evaluate and redo. The window is shifted back by one turn as the child's eval gets worsened by process_eval
+            position->perform_move(m);
+            int new_eval = evaluate(position, maxdepth-1, cache, -unprocess_eval(beta), -unprocess_eval(alfa), ply+1, extensions) * side;
+            position->undo_move();
+            if(search_control.stopped){
+                // the evaluation of the child is not reliable, nothing is cached
+                return 0;
+            }
             if(new_eval > eval){
                 eval = new_eval;
-                if(eval > alfa){
-                    alfa = eval;
+                best_move = m.pack();
+                if(process_eval(eval) > alfa){
+                    alfa = process_eval(eval);
                 }
             }
-            position->undo_move();
             if(process_eval(eval) >= beta){
-                // alfa-beta cutoff, we didn't investigate full position => no caching
+                // alfa-beta cutoff, we didn't investigate full position => the eval is only lower bound
+                statistics.cutoffs[std::min(ply, MAX_STATISTICS_PLY - 1)]++;
+                statistics.first_move_cutoffs += first_move;
+                if(!m.is_capture() && !m.is_promotion()){
+                    killers.store(ply, m);
+                }
+                (*cache)[hash] = {maxdepth, process_eval(eval) * side, LOWER_BOUND * side, m.pack()};
                 return process_eval(eval) * side; 
             }
+            first_move = false;
         }
-        // save result into cache
-        if(cached_result != cache->end()){
-            cached_result->second = {abs(eval) > MATE_THRESHOLD ? __INT_MAX__ : maxdepth, process_eval(eval) * side};
-        } else {
-            cache->insert({hash, {abs(eval) > MATE_THRESHOLD ? __INT_MAX__: maxdepth, process_eval(eval) * side}});
-        }
+        // save result into cache, if no move got over alfa, the eval is only upper bound (and the best move is not known).
+        // The mate distance is counted from this position, so an exact mate holds for any deeper search and any ply the position
+        // is reached at, unless it depends on the path (e.g. a defence was cut as a repetition) or it was found thanks to extensions
+        // beyond maxdepth (a shorter mate may be hidden in the lines which were not extended, mates up to maxdepth + 1 half-moves
+        // are the fastest ones, as the shorter mates of the same side are searched to the full width)
+        int bound = process_eval(eval) <= original_alfa ? UPPER_BOUND : EXACT;
+        bool path_independent = path_dependent_evals == path_dependent;
+        bool fastest = extended_searches == extended || MATE - abs(process_eval(eval)) <= maxdepth + 1;
+        int depth = (bound == EXACT && abs(eval) > MATE_THRESHOLD && path_independent && fastest) ? __INT_MAX__ : maxdepth;
+        (*cache)[hash] = {depth, process_eval(eval) * side, bound * side, bound == EXACT ? best_move : tt_move};
         return process_eval(eval) * side;
     }
 
@@ -143,23 +325,120 @@ namespace Engine{
      * @brief Evaluate the position iteratively, gradually increasing the depth of search. Due to the nature of search,
      * as we can use the evaluation from previous iteration to guess the order of search, it usually tends to be
      * faster than direct aprroach
+     *
+     * @param stats if not null, statistics of every iteration are added to it
      */
-    int iter_evaluate(Position* position, int maxdepth, Cache* cache){
+    int iter_evaluate(Position* position, int maxdepth, Cache* cache, SearchStats* stats){
         for(int depth = 1; depth <= maxdepth; depth++){
+            if(stats != nullptr){
+                stats->start_iteration();
+            }
             evaluate(position, depth, cache);
+            if(stats != nullptr){
+                stats->finish_iteration(depth);
+            }
         }
         return evaluate(position, maxdepth, cache);
     }
 
+    /**
+     * @brief Iterated search (see Engine::iter_evaluate) within the limits. Iterations continue until the depth limit is reached,
+     * the search is stopped or the position is evaluated as the fastest mate. Without any limit, Engine::MAX_DEPTH is searched
+     * 
+     * @param stats if not null, statistics of every completed iteration are added to it
+     */
+    SearchResult search(Position* position, Cache* cache, const SearchLimits& limits, SearchStats* stats){
+        SearchScope scope(limits);
+        SearchResult result;
+        bool unlimited = limits.time <= 0 && limits.nodes == 0 && limits.cancel == nullptr;
+        int maxdepth = limits.depth > 0 ? limits.depth : (unlimited ? MAX_DEPTH : __INT_MAX__);
+        for(int depth = 1; depth <= maxdepth; depth++){
+            if(stats != nullptr){
+                stats->start_iteration();
+            }
+            int eval = evaluate(position, depth, cache);
+            if(search_stopped()){
+                result.stopped = true;
+                break;
+            }
+            if(stats != nullptr){
+                stats->finish_iteration(depth);
+            }
+            result.eval = eval;
+            result.depth = depth;
+            if(is_fastest_mate(position, eval, depth, cache) || depth == __INT_MAX__){
+                // deeper iterations cannot change the evaluation
+                break;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief un-does the last move of the position and searches the previous position, reusing the search of the position.
+     * Used to walk a game back from a mate (see Engine::generate_puzzle_by_playing): the un-done move is searched first
+     * and the window is bounded by the mate of the position (the previous position is at least as good for the player to move
+     * as the un-done move), so the previous position costs about as much as the moves not searched yet
+     *
+     * @param eval evaluation of the position (see Engine::evaluate), a mate
+     *
+     * @return evaluation of the previous position searched to maxdepth if it is a mate of the same side as eval, 0 otherwise
+     */
+    int undo_and_evaluate(Position* position, int maxdepth, int eval, Cache* cache){
+        Move move = position->last_move();
+        position->undo_move();
+        int side = position->m_to_move == 'w' ? 1 : -1;
+        int attacker = eval > 0 ? 1 : -1;
+        // the un-done move gives the previous position at least the evaluation of the position one half-move later
+        int bound = process_eval(eval);
+        // only mates of the attacker are of interest: the attacker searches for a faster mate than the un-done move gives,
+        // the defender for a slower one, any line without the attacker's mate fails high and is cut
+        int alfa = bound * side - 1;
+        int beta = side == attacker ? MATE : -MATE_THRESHOLD;
+        root_move_hint = move.pack();
+        int result = evaluate(position, maxdepth, cache, alfa, beta) * side;
+        if(result <= alfa && !search_stopped()){
+            // the un-done move did not give the bound (the mate depended on the path to the position), searched with full window
+            result = evaluate(position, maxdepth, cache) * side;
+        }
+        root_move_hint = 0;
+        result *= side;
+        return result * attacker > MATE_THRESHOLD ? result : 0;
+    }
+
+    /**
+     * @brief returns true if the mate evaluation of the position searched to given depth is the fastest mate: it is at most
+     * depth + 1 half-moves long (the shorter mates are searched to the full width) or it is stored in the cache as proven
+     * (see Engine::evaluate, longer mates may be found thanks to extensions, while a shorter mate exists)
+     */
+    bool is_fastest_mate(Position* position, int eval, int depth, Cache* cache){
+        if(abs(eval) < MATE_THRESHOLD){
+            return false;
+        }
+        if(MATE - abs(eval) <= depth + 1){
+            return true;
+        }
+        auto cached_result = cache->find(position->get_hash());
+        return cached_result != cache->end() && cached_result->second.depth == __INT_MAX__;
+    }
+
     /**
      * @brief search for the fastest mate.
      *  
+     * @param stats if not null, statistics of every iteration are added to it
+     *
      * @return std::string representing the evaluation (e.g. "White mates in 3" or "Unknown result")
      */
-    std::string find_fastest_mate(Position* position, int max_moves, Cache* cache){
+    std::string find_fastest_mate(Position* position, int max_moves, Cache* cache, SearchStats* stats){
         for(int depth = 0; depth < max_moves; depth++){
+            if(stats != nullptr){
+                stats->start_iteration();
+            }
             int eval = evaluate(position, 2*depth, cache);
-            if(abs(eval) > MATE_THRESHOLD){
+            if(stats != nullptr){
+                stats->finish_iteration(2*depth);
+            }
+            if(is_fastest_mate(position, eval, 2*depth, cache)){
                 auto s = eval > 0 ? std::string("White ") : std::string("Black ");
                 s += "mates in ";
                 s += std::to_string((MATE - abs(eval) + 1)/2);
@@ -170,45 +449,151 @@ namespace Engine{
     }
 
     /**
-     * @brief plays a move with the best evaluation with specified depth.
-     * If there are more moves with the best evaluation, choose one at random
+     * @brief search for the fastest mate (of any side) within max_moves moves, gradually increasing the depth by one half-move
      * 
-     * Uses std::random_shuffle, thus can be seeded by srand()
+     * @return evaluation of the position (see Engine::evaluate), mate score if a mate within max_moves moves was found
+     * (0 if only a longer mate was found thanks to extensions, in the cache or in the tablebase)
+     */
+    int find_mate(Position* position, int max_moves, Cache* cache){
+        int eval = 0;
+        for(int depth = 1; depth < 2 * max_moves; depth++){
+            eval = evaluate(position, depth, cache);
+            if(is_fastest_mate(position, eval, depth, cache)){
+                // a proven mate may come from the cache or the tablebase, then it can be longer than max_moves
+                return MATE - abs(eval) < 2 * max_moves ? eval : 0;
+            }
+        }
+        // a mate found thanks to extensions, which is not proven to be the fastest one, is longer than max_moves
+        return abs(eval) > MATE_THRESHOLD ? 0 : eval;
+    }
+
+    /**
+     * @brief returns the number of moves to mate for mate evaluation (e.g. 2 for both MATE - 3 and -(MATE - 4)), 0 for other evaluations
      * 
-     * If the position is mate or stalemate, return without perfoming any changes to the position
+     */
+    int moves_to_mate(int eval){
+        if(abs(eval) < MATE_THRESHOLD){
+            return 0;
+        }
+        return (MATE - abs(eval) + 1)/2;
+    }
+
+    /**
+     * @brief returns the line of best moves found by search of given depth. If there are more best moves, the first one found
+     * is chosen, so the result is deterministic. The position is not changed.
+     * 
+     */
+    std::vector<Move> get_principal_variation(Position* position, int depth, Cache* cache){
+        auto line = std::vector<Move>();
+        int eval = iter_evaluate(position, depth, cache);
+        for(; depth > 0; depth--){
+            bool found = false;
+            for(auto m : position->get_possible_moves()){
+                position->perform_move(m);
+                int child = position->repetitions() > 0 ? 0 : process_eval(iter_evaluate(position, depth-1, cache));
+                if(child == eval){
+                    line.push_back(m);
+                    eval = evaluate(position, depth-1, cache);
+                    found = true;
+                    break;
+                }
+                position->undo_move();
+            }
+            if(!found){
+                // mate / stalemate, or the evaluations stored in cache do not match (the line ends here)
+                break;
+            }
+        }
+        for(size_t i = 0; i < line.size(); i++){
+            position->undo_move();
+        }
+        return line;
+    }
+
+    /**
+     * @brief Multi-PV search. Evaluates every legal move of the position by a search of given depth in one pass
+     * (the children are searched iteratively and share the cache, so the evaluations of the previous moves help ordering of the next ones)
      * 
-     * Throws const char* if internal logic error is encountered
+     * @param lower_limit evaluations (from the point of view of the player to move) of moves, which are worse than lower_limit,
+     * are only upper bounds. Such moves are refuted by a cheap null-window search. Use -MATE to get exact evaluations of all moves
+     * 
+     * @return all legal moves with their evaluations (from white's point of view, already processed by Engine::process_eval,
+     * so the evaluation of the best move is the evaluation of the position)
      */
-    void play_random_best(Position* position, int max_depth, Cache* cache){;
-        auto moves = position->get_possible_moves();
-        std::random_shuffle(moves.begin(), moves.end());
+    std::vector<std::pair<Move, int>> evaluate_moves(Position* position, int depth, Cache* cache, int lower_limit){
+        // the move reaches lower_limit, if the eval of the opponent is at most child_limit
+        int child_limit = -unprocess_eval(lower_limit);
+        auto result = std::vector<std::pair<Move, int>>();
+        for(auto m : position->get_possible_moves()){
+            position->perform_move(m);
+            int eval = 0;
+            for(int d = 0; d < std::max(depth, 1); d++){
+                // children are searched iteratively (as in Engine::iter_evaluate) with ply 1, so that repetitions are draws
+                eval = evaluate(position, d, cache, -MATE - 1, child_limit + 1, 1);
+            }
+            position->undo_move();
+            result.push_back({m, process_eval(eval)});
+        }
+        return result;
+    }
 
-        if(moves.size() == 0){
-            //cannot move any further
-            return;
+    /**
+     * @brief returns all moves with the best evaluation of given depth. The position is searched first, then all moves
+     * are evaluated by one multi-PV search (see Engine::evaluate_moves) with the evaluation of the position as the lower limit
+     * 
+     */
+    std::vector<Move> get_best_moves(Position* position, int depth, Cache* cache){
+        int side = position->m_to_move == 'w' ? 1 : -1;
+        int best = iter_evaluate(position, depth, cache) * side;
+        auto evaluated = evaluate_moves(position, depth, cache, best);
+        auto result = std::vector<Move>();
+        for(auto pair : evaluated){
+            if(pair.second * side == best){
+                result.push_back(pair.first);
+            }
+        }
+        if(result.empty() && !evaluated.empty()){
+            // the stored evaluations were inconsistent (e.g. due to repetitions), evaluate all moves exactly
+            evaluated = evaluate_moves(position, depth, cache);
+            best = -MATE - 1;
+            for(auto pair : evaluated){
+                best = std::max(best, pair.second * side);
+            }
+            for(auto pair : evaluated){
+                if(pair.second * side == best){
+                    result.push_back(pair.first);
+                }
+            }
         }
+        return result;
+    }
 
+    /**
+     * @brief plays a move with the best evaluation with specified depth.
+     * If there are more moves with the best evaluation, choose one at random
+     * 
+     * The best moves are found by one multi-PV search (see Engine::get_best_moves), uses rand(), thus can be seeded by srand()
+     * 
+     * If the position is mate or stalemate, return without perfoming any changes to the position
+     */
+    void play_random_best(Position* position, int max_depth, Cache* cache){
         // Evaluation may have went deeper and changed, reevaluate the position to make sure the evaluation is actual
         cache->erase(position->get_hash());
 
-        int target = iter_evaluate(position, max_depth, cache);
-        for(auto m : moves){
-            position->perform_move(m);
-            if(process_eval(iter_evaluate(position, max_depth-1, cache)) == target){
-                return;
-            }
-            position->undo_move();
+        auto best_moves = get_best_moves(position, max_depth, cache);
+        if(best_moves.size() == 0){
+            //cannot move any further
+            return;
         }
-        
-        // Assert (unreachable) - this shouldn't ever happen
-        throw "Could't play random best, internal logic error";
+        position->perform_move(best_moves[rand() % best_moves.size()]);
     }
 
     /**
      * @brief generates a puzzle by letting the engine play itself.
      * 
-     * @param max_moves max moves complexity of the puzzle to be generated (usually the puzzles are 2 or 3 moves long at max, exceptionally 4). 
-     * This is due to setting the Engine::MAX_DEPTH to 5. Changing this setting may yield harder puzzles, but exponential performance change.
+     * @param max_moves max moves complexity of the puzzle to be generated (usually the puzzles are 2 to 4 moves long at max, exceptionally 5). 
+     * This is due to setting the Engine::MAX_DEPTH to 5, forced lines reach deeper thanks to extensions (see Engine::MAX_EXTENSIONS).
+     * Changing these settings may yield harder puzzles, but exponential performance change.
      * 
      * @param verbose if true, the process reports the current state of generation into std::cout
      * @param seed value used to generate the puzzles. Same seeds will return same puzzles.
@@ -216,97 +601,375 @@ namespace Engine{
      * 
      * @return Position the puzzle
      */
-    Position generate_puzzle_by_playing(Cache* cache, int max_moves, bool verbose, std::string seed){
-        if(seed.length() > 0){
-            // To get deterministic result from seed we need to clear the cache
-            // The program will (in some cases) need the cache after generating the puzzle to solve it
+    Position generate_puzzle_by_playing(Cache* cache, int max_moves, bool verbose, std::string seed, GenerationOptions options, GenerationReport* report){
+        // To get deterministic result from seed we need to clear the cache (and killer moves, which affect the order of search)
+        // The program will (in some cases) need the cache after generating the puzzle to solve it
+        auto reseed = [&](const std::string& value){
             cache->clear();
-            srand(std::hash<std::string>{}(seed));
+            clear_killers();
+            srand(std::hash<std::string>{}(value));
+        };
+        if(seed.length() > 0){
+            reseed(seed);
         }   
         if(verbose){
             std::cout << "Generating puzzle...";
         }
-        Position pos = Position();
-        while(abs(evaluate(&pos, MIN_DEPTH, cache)) < MATE_THRESHOLD){
-            if(pos.m_prev_moves.size() > 150 || pos.get_possible_moves().size() == 0){
-                // the enigne was sometimes getting stuck inside positions (K+R vs K), which didn't lead to puzzles
-                // or in stalemate, which cannot be played any longer, but doesn't yield a puzzle
-                pos = Position();
+        // adds the time since given start to the statistics
+        auto add_time = [](double* time, std::chrono::steady_clock::time_point start){
+            *time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+        // returns true if the generation has to be given up (the token was cancelled or the outer limits were exceeded)
+        auto generation_stopped = [&](){
+            bool stopped = search_stopped() || (options.game_limits.cancel != nullptr && options.game_limits.cancel->is_cancelled())
+                || (options.puzzle_limits.cancel != nullptr && options.puzzle_limits.cancel->is_cancelled());
+            if(stopped && report != nullptr){
+                report->cancelled = true;
+            }
+            return stopped;
+        };
+        // records the game, which exceeded its limits
+        auto abandon_game = [&](){
+            statistics.abandoned_games++;
+            if(report != nullptr){
+                report->abandoned_games++;
             }
-            play_random_best(&pos, MIN_DEPTH, cache);
             if(verbose){
-                std::cout << "#" << std::flush;
+                std::cout << "...out of budget, abandoned!" << std::endl << "Generating puzzle...";
             }
-        }
-        if(verbose){
-            std::cout << "...done!" << std::endl << "Reinforcing the puzzle...";
-        }
-        // save the information of longest puzzle, to know where to return
-        int longest_mate = 0;
+        };
+        // returns the position, from which a new game starts
+        auto start_position = [&](){
+            if(options.start_pool == nullptr || options.start_pool->empty()){
+                return Position();
+            }
+            return options.start_pool->get(rand() % options.start_pool->size());
+        };
+        // budget of the whole puzzle, when it is exhausted, the generation starts again with a new budget
+        auto puzzle_scope = std::make_unique<SearchScope>(options.puzzle_limits);
+        int puzzle_restarts = 0;
+        while(true){
+            if(search_stopped()){
+                // the puzzle scope ends first, so that only the outer limits are checked
+                puzzle_scope.reset();
+                if(!generation_stopped()){
+                    puzzle_restarts++;
+                    statistics.puzzle_restarts++;
+                    if(report != nullptr){
+                        report->puzzle_restarts++;
+                    }
+                    if(seed.length() > 0){
+                        // the seed of the restart is derived from the given one, so the result stays deterministic (for node budget)
+                        reseed(seed + "/restart_" + std::to_string(puzzle_restarts));
+                    }
+                    if(verbose){
+                        std::cout << "...puzzle out of budget, restarted!" << std::endl << "Generating puzzle...";
+                    }
+                    puzzle_scope = std::make_unique<SearchScope>(options.puzzle_limits);
+                }
+            }
+            if(generation_stopped()){
+                return Position();
+            }
+            // every game has its own budget, the searches return meaningless evaluations once it is exhausted
+            SearchScope game_scope(options.game_limits);
+            Position pos = start_position();
+            statistics.games++;
+            auto random_play_start = std::chrono::steady_clock::now();
+            // with tablebases, long mates of simple endgames are found immediately, the game continues until the mate is short enough
+            while(abs(evaluate(&pos, MIN_DEPTH, cache)) < MATE_THRESHOLD || moves_to_mate(evaluate(&pos, MIN_DEPTH, cache)) > max_moves){
+                if(search_stopped()){
+                    break;
+                }
+                if(pos.ply() > 150 || pos.is_draw() || pos.get_possible_moves().size() == 0){
+                    // the enigne was sometimes getting stuck inside positions (K+R vs K), which didn't lead to puzzles,
+                    // the game may end by repetition / fifty-move rule
+                    // or in stalemate, which cannot be played any longer, but doesn't yield a puzzle
+                    pos = start_position();
+                    statistics.games++;
+                    statistics.restarts++;
+                }
+                play_random_best(&pos, MIN_DEPTH, cache);
+                if(verbose){
+                    std::cout << "#" << std::flush;
+                }
+                if(options.statistics_log != nullptr){
+                    options.statistics_log->tick();
+                }
+            }
+            add_time(&statistics.random_play_time, random_play_start);
+            if(search_stopped()){
+                abandon_game();
+                continue;
+            }
+            auto reinforcement_start = std::chrono::steady_clock::now();
+            uint64_t decisive_key = canonical_key(&pos);
+            if(options.dedup != nullptr && options.dedup->contains(decisive_key)){
+                // the game converged to a position, which was already made into a puzzle, skip it before the expensive reinforcement
+                if(report != nullptr){
+                    report->duplicates++;
+                }
+                if(verbose){
+                    std::cout << "...known puzzle, skipped!" << std::endl << "Generating puzzle...";
+                }
+                continue;
+            }
+            if(verbose){
+                std::cout << "...done!" << std::endl << "Reinforcing the puzzle...";
+            }
+            // save the information of longest puzzle, to know where to return
+            int longest_mate = 0;
 
-        // save the undone moves in case of need to re-do some of them to return to the position with longest puzzle
-        auto undone_moves = std::vector<Move>();
+            // save the undone moves in case of need to re-do some of them to return to the position with longest puzzle
+            auto undone_moves = std::vector<Move>();
 
-        for(int depth = 2; abs(iter_evaluate(&pos, depth, cache)) > MATE_THRESHOLD;){
-            int moves_to_mate = (MATE - abs(evaluate(&pos, MIN_DEPTH, cache)) + 1)/2;
-            if(moves_to_mate > longest_mate){
-                longest_mate = moves_to_mate;
+            // every previous position is searched from the search of the next one (see Engine::undo_and_evaluate),
+            // only the moves other than the un-done one are searched again
+            int depth = 2;
+            int eval = iter_evaluate(&pos, depth, cache);
+            while(abs(eval) > MATE_THRESHOLD){
+                int moves_to_mate = (MATE - abs(eval) + 1)/2;
+                if(moves_to_mate > longest_mate){
+                    longest_mate = moves_to_mate;
+                }
+                if(moves_to_mate == max_moves || pos.ply() == 0){
+                    // We reached the required max moves, no need for further search
+                    // (or the game started from the mate, there are no moves to undo)
+                    break;
+                }
+                undone_moves.push_back(pos.last_move());
+                if(depth < MAX_DEPTH){
+                    depth++;
+                }
+                eval = undo_and_evaluate(&pos, depth, eval, cache);
+                if(verbose){
+                    std::cout << "#" << std::flush;
+                }
+                if(options.statistics_log != nullptr){
+                    options.statistics_log->tick();
+                }
             }
-            if(moves_to_mate == max_moves){
-                // We reached the required max moves, no need for further search
-                break;
+            if(search_stopped()){
+                add_time(&statistics.reinforcement_time, reinforcement_start);
+                abandon_game();
+                continue;
             }
-            undone_moves.push_back(pos.m_prev_moves.back());
-            pos.undo_move();
-            if(depth < MAX_DEPTH){
-                depth++;
+            if(abs(eval) < MATE_THRESHOLD){
+                // prev evaluation of any depth did not end as forced mate -> we have undone too many moves
+                pos.perform_move(undone_moves.back());
+                undone_moves.pop_back();
+            }
+
+            // at this point, the position should lead to forced mate.
+
+            // mate in max_moves or longest mate whichever is lower
+            int target = max_moves < longest_mate ? max_moves : longest_mate;
+
+            while((MATE - abs(evaluate(&pos, MIN_DEPTH, cache)) + 1) / 2 < target){
+                // redo undone moves until we reach position with target moves to mate
+                pos.perform_move(undone_moves.back());
+                undone_moves.pop_back();
+            }
+
+            // at this point, the position should be longest found mate or of requested moves
+            if(abs(evaluate(&pos, MIN_DEPTH, cache)) % 2 == 0){
+                // losing side is on move, play best move (not shortening the puzzle)
+                play_random_best(&pos, 2, cache);
+            }
+
+            // the mate may have been found thanks to extensions while a shorter one exists. A shorter mate (of the same side)
+            // is at least two half-moves shorter, so one zero-window search to that depth around the mate score proves the mate,
+            // the search is cut as soon as a line cannot mate faster. Only if a faster mate exists, it is searched exactly
+            int verified_eval = evaluate(&pos, MIN_DEPTH, cache);
+            while(abs(verified_eval) > MATE_THRESHOLD && !is_fastest_mate(&pos, verified_eval, MIN_DEPTH, cache) && !search_stopped()){
+                int side = pos.m_to_move == 'w' ? 1 : -1;
+                int relative = verified_eval * side;
+                int depth = MATE - abs(verified_eval) - 2;
+                // faster mate is better for the attacker and worse for the defender
+                int alfa = relative > 0 ? relative : relative - 1;
+                int result = evaluate(&pos, depth, cache, alfa, alfa + 1) * side;
+                if(relative > 0 ? result <= alfa : result > alfa){
+                    break;
+                }
+                verified_eval = evaluate(&pos, depth, cache);
+            }
+            if(search_stopped()){
+                add_time(&statistics.reinforcement_time, reinforcement_start);
+                abandon_game();
+                continue;
+            }
+
+            uint64_t puzzle_key = canonical_key(&pos);
+            if(options.dedup != nullptr && options.dedup->contains(puzzle_key)){
+                // other game was reinforced to the same puzzle
+                if(report != nullptr){
+                    report->duplicates++;
+                }
+                add_time(&statistics.reinforcement_time, reinforcement_start);
+                if(verbose){
+                    std::cout << "...known puzzle, skipped!" << std::endl << "Generating puzzle...";
+                }
+                continue;
+            }
+
+            if(options.dual_solutions != DualSolutions::ALLOW){
+                bool unique = has_unique_solution(&pos, cache);
+                if(report != nullptr){
+                    report->unique_solution = unique;
+                }
+                if(!unique && options.dual_solutions == DualSolutions::REJECT && !search_stopped()){
+                    // generate another puzzle, the random sequence continues so the result stays deterministic
+                    add_time(&statistics.reinforcement_time, reinforcement_start);
+                    if(verbose){
+                        std::cout << "...dual solution, rejected!" << std::endl << "Generating puzzle...";
+                    }
+                    continue;
+                }
+            }
+            if(options.build_solution_tree && report != nullptr){
+                report->solution = build_solution_tree(&pos, cache);
+            }
+            if(search_stopped()){
+                // the budget ran out while checking the solutions
+                add_time(&statistics.reinforcement_time, reinforcement_start);
+                abandon_game();
+                continue;
+            }
+            if(options.dedup != nullptr){
+                options.dedup->insert(decisive_key);
+                options.dedup->insert(puzzle_key);
+            }
+            add_time(&statistics.reinforcement_time, reinforcement_start);
+            statistics.puzzles++;
+            if(options.statistics_log != nullptr){
+                options.statistics_log->tick();
             }
             if(verbose){
-                std::cout << "#" << std::flush;
+                std::cout << "...done!" << std::endl;
             }
+            return pos;
         }
-        if(abs(evaluate(&pos, MIN_DEPTH, cache)) < MATE_THRESHOLD){
-            // prev evaluation of any depth did not end as forced mate -> we have undone too many moves
-            pos.perform_move(undone_moves.back());
-            undone_moves.pop_back();
-        }
+    }
 
-        // at this point, the position should lead to forced mate.
+    /**
+     * @brief return true if the given move is the best move in the position (there can be more best moves)
+     * 
+     * To check more moves in the same position, compute Engine::get_best_moves once and look the moves up there.
+     */
+    bool is_solution(Position* puzzle, Move move, Cache* cache){
+        auto solutions = get_best_moves(puzzle, MATE - abs(evaluate(puzzle, MIN_DEPTH, cache)), cache);
+        return std::find(solutions.begin(), solutions.end(), move) != solutions.end();
+    }
 
-        // mate in max_moves or longest mate whichever is lower
-        int target = max_moves < longest_mate ? max_moves : longest_mate;
-        
-        while((MATE - abs(evaluate(&pos, MIN_DEPTH, cache)) + 1) / 2 < target){
-            // redo undone moves until we reach position with target moves to mate
-            pos.perform_move(undone_moves.back());
-            undone_moves.pop_back();
+    /**
+     * @brief returns moves of the player to move, which mate at least as fast as the best move (at most max_count moves are returned).
+     * The position has to be evaluated as mate for the player to move.
+     * 
+     * Each move is tested by zero-window search around the mate score, which is cheap, as it mostly reuses the cache.
+     */
+    std::vector<Move> get_mating_moves(Position* position, Cache* cache, int max_count){
+        auto result = std::vector<Move>();
+        int side = position->m_to_move == 'w' ? 1 : -1;
+        int eval = evaluate(position, MIN_DEPTH, cache) * side;
+        if(eval < MATE_THRESHOLD){
+            return result;
         }
+        for(auto m : position->get_possible_moves()){
+            position->perform_move(m);
+            // the move mates as fast as the best one if the opponent's eval is at most -unprocess_eval(eval)
+            int target = -unprocess_eval(eval);
+            int child = evaluate(position, MATE - eval - 1, cache, target, target + 1, 1) * -side;
+            position->undo_move();
+            if(child <= target){
+                result.push_back(m);
+                if((int)result.size() >= max_count){
+                    break;
+                }
+            }
+        }
+        return result;
+    }
 
-        // at this point, the position should be longest found mate or of requested moves
-        if(abs(evaluate(&pos, MIN_DEPTH, cache)) % 2 == 0){
-            // losing side is on move, play best move (not shortening the puzzle)
-            play_random_best(&pos, 2, cache);
+    /**
+     * @brief checks that the attacker has exactly one fastest mating move in the position (the attacker is to move)
+     * and after every best defense to it, recursively until the mate
+     */
+    bool has_unique_continuation(Position* position, Cache* cache){
+        auto mating_moves = get_mating_moves(position, cache, 2);
+        if(mating_moves.size() != 1){
+            // more solutions, or none at all (the evaluation of the position is inconsistent)
+            return false;
         }
-        if(verbose){
-            std::cout << "...done!" << std::endl;
+        position->perform_move(mating_moves[0]);
+        bool unique = true;
+        if(position->has_legal_moves()){
+            int eval = evaluate(position, MIN_DEPTH, cache);
+            // the defender's best moves are the ones which delay the mate the most
+            auto defenses = abs(eval) > MATE_THRESHOLD ? get_best_moves(position, MATE - abs(eval), cache) : std::vector<Move>();
+            unique = !defenses.empty();
+            for(auto m : defenses){
+                position->perform_move(m);
+                unique = has_unique_continuation(position, cache);
+                position->undo_move();
+                if(!unique){
+                    break;
+                }
+            }
         }
-        return pos;
+        position->undo_move();
+        return unique;
     }
 
     /**
-     * @brief return true if the given move is the best move in the position (there can be more best moves)
+     * @brief checks that the attacker has exactly one fastest mating move at each step of the solution,
+     * after every best defense (all defenses, which delay the mate the most, are followed)
      * 
+     * @return true if the puzzle has single solution (false also if no mating move is found, although the puzzle is evaluated as mate)
      */
-    bool is_solution(Position* puzzle, Move move, Cache* cache){
+    bool has_unique_solution(Position* puzzle, Cache* cache){
         int eval = evaluate(puzzle, MIN_DEPTH, cache);
-        puzzle->perform_move(move);
-        if (process_eval(iter_evaluate(puzzle, MATE - abs(eval) - 1, cache)) == eval){
-            puzzle->undo_move();
-            return true;
-        } else {
-            puzzle->undo_move();
+        int side = puzzle->m_to_move == 'w' ? 1 : -1;
+        if(eval * side < MATE_THRESHOLD){
+            // the puzzle is not a mate of the player to move
             return false;
         }
+        return has_unique_continuation(puzzle, cache);
+    }
+
+    /**
+     * @brief adds children (all best moves) to the node of the solution tree and recursively expands them
+     * 
+     * @param plies number of half-moves to mate in the position of the node
+     */
+    void expand_solution_node(Position* position, Cache* cache, SolutionTree* tree, int node, int plies){
+        if(plies <= 0){
+            // mate
+            return;
+        }
+        auto moves = get_best_moves(position, plies, cache);
+        int first = tree->m_nodes.size();
+        tree->m_nodes[node].first_child = first;
+        tree->m_nodes[node].child_count = moves.size();
+        for(auto m : moves){
+            tree->m_nodes.push_back({m, 0, 0});
+        }
+        for(size_t i = 0; i < moves.size(); i++){
+            position->perform_move(moves[i]);
+            expand_solution_node(position, cache, tree, first + i, plies - 1);
+            position->undo_move();
+        }
+    }
+
+    /**
+     * @brief builds tree of all solutions of the puzzle (all fastest mating moves of the attacker and all best defenses)
+     * The puzzle has to be evaluated as mate.
+     * 
+     */
+    SolutionTree build_solution_tree(Position* puzzle, Cache* cache){
+        SolutionTree tree;
+        tree.m_plies_to_mate = MATE - abs(evaluate(puzzle, MIN_DEPTH, cache));
+        expand_solution_node(puzzle, cache, &tree, 0, tree.m_plies_to_mate);
+        return tree;
     }
 
 }
\ No newline at end of file
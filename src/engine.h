@@ -1,34 +1,53 @@
 #pragma once
 
 #include "position.h"
+#include "solution_tree.h"
+#include "dedup.h"
+#include "start_pool.h"
+#include "statistics.h"
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <iostream>
-
-#define Cache std::unordered_map<size_t, std::pair<int, int>>
+#include <atomic>
+#include <chrono>
 
 namespace Engine{
 
-    // Piece values used in evaluation
-    const std::unordered_map<char, int> piece_values = {
-        {'K', 1000},
-        {'Q', 9},
-        {'R', 5},
-        {'N', 3},
-        {'B', 3},
-        {'P', 1},
-        {'k', -1000},
-        {'q', -9},
-        {'r', -5},
-        {'n', -3},
-        {'b', -3},
-        {'p', -1},
+    // Values of CacheEntry::bound. Bounds are stored from white's point of view (as the evaluation), so negating the bound
+    // gives the bound from black's point of view
+    const int EXACT = 0;
+    const int LOWER_BOUND = 1;
+    const int UPPER_BOUND = -1;
+
+    /**
+     * @brief Evaluation of a position stored in the cache
+     * 
+     */
+    struct CacheEntry{
+
+        // depth of the search, __INT_MAX__ for final results (mate, stalemate, ...)
+        int depth;
+
+        // evaluation (see Engine::evaluate)
+        int eval;
+
+        // EXACT if the eval is exact, LOWER_BOUND if the search failed high, UPPER_BOUND if the search failed low
+        int bound;
+
+        // best (or refuting) move found by the search (see Move::pack) or 0 if there is none, searched first next time
+        uint16_t move = 0;
     };
+}
+
+#define Cache std::unordered_map<size_t, Engine::CacheEntry>
+
+namespace Engine{
 
     // Evaluation value for mate in 0
     const int MATE = 1000000;
 
-    // Minimal evaluation value which is considered as mate (should be more than sum of piece values)
+    // Minimal evaluation value which is considered as mate (should be more than sum of piece values, see piece_value())
     const int MATE_THRESHOLD = 2000;
 
     // Smallest default depth used in calculations. Changing this value will have huge performance impact
@@ -37,6 +56,9 @@ namespace Engine{
     // Highest default depth used in calculations. Changing this value will allow generation of harder puzzles, but thta will impact performance
     const int MAX_DEPTH = 5;
 
+    // Maximal number of half-moves by which one line of the search can be extended (see Engine::evaluate)
+    const int MAX_EXTENSIONS = 4;
+
 
     /**
      * @brief Worsen eval by 1 every turn so that engine chooses fastest mate
@@ -45,18 +67,114 @@ namespace Engine{
     int process_eval(int num);
 
     /**
-     * @brief Get the evaluation guess, used for ordering search in alfa/beta search
+     * @brief Inverse of Engine::process_eval. Used to shift alfa/beta window to the child position
      * 
-     * @return int previous evaluation of the position of longest depth or 0 if there is no information in the cache
      */
-    int get_eval_guess(size_t hash, Cache* cache);
+    int unprocess_eval(int num);
+
+    /**
+     * @brief forgets the killer moves of the current thread (see Engine::KillerTable), so that the next search does not depend on the previous ones
+     */
+    void clear_killers();
+
+    /**
+     * @brief Flag shared between threads, which stops the searches using it (see Engine::SearchLimits)
+     * 
+     */
+    struct CancellationToken{
+        std::atomic<bool> cancelled{false};
 
+        // stops the searches as soon as they check the token
+        void cancel();
+
+        bool is_cancelled() const;
+    };
 
     /**
-     * @brief Comparator used to sort std::vector<std::pair<int, Move>> in descending order
+     * @brief Limits of searches (see Engine::SearchScope). A stopped search returns an unreliable evaluation, which is not cached
      * 
      */
-    bool sort_moves(const std::pair<int,Move> a, std::pair<int,Move> b);
+    struct SearchLimits{
+
+        // maximal wall time in seconds, 0 for no limit (the result then depends on the speed of the computer)
+        double time = 0;
+
+        // maximal number of searched nodes (see Statistics::nodes), 0 for no limit
+        uint64_t nodes = 0;
+
+        // maximal depth of iterated search, 0 for no limit. Only Engine::search uses it, Engine::SearchScope
+        // (and thus the generator) limits only the time, the nodes and the token
+        int depth = 0;
+
+        // if not nullptr, the search stops when the token is cancelled (the tokens of the outer scopes are checked as well)
+        const CancellationToken* cancel = nullptr;
+    };
+
+    /**
+     * @brief Cancellation tokens of nested scopes (see Engine::SearchScope), the token of the innermost scope first
+     * 
+     */
+    struct CancelChain{
+        const CancellationToken* token;
+
+        // tokens of the outer scopes, nullptr if there are none
+        const CancelChain* outer;
+    };
+
+    /**
+     * @brief Limits of the searches of the current thread in absolute values, checked by Engine::evaluate
+     * 
+     */
+    struct SearchControl{
+
+        // false if there are no limits, so that the search does not check them
+        bool active = false;
+
+        // true if a limit was exceeded, all searches of the thread return immediately
+        bool stopped = false;
+
+        bool has_deadline = false;
+        std::chrono::steady_clock::time_point deadline;
+
+        // value of Statistics::nodes at which the search stops, 0 for no limit
+        uint64_t node_limit = 0;
+
+        // tokens of all scopes, the search stops when any of them is cancelled
+        const CancelChain* cancel = nullptr;
+    };
+
+    /**
+     * @brief Applies the limits to all searches of the current thread until the scope ends. Scopes may be nested,
+     * the inner scope is limited also by the outer one
+     * 
+     */
+    class SearchScope{
+
+        public:
+            SearchScope(const SearchLimits& limits);
+
+            ~SearchScope();
+
+        private:
+            // limits of the outer scope, restored at the end of the scope
+            SearchControl m_outer;
+
+            // token of this scope linked to the tokens of the outer scopes (used only if the limits have a token)
+            CancelChain m_cancel;
+    };
+
+    /**
+     * @brief returns true if the searches of the current thread were stopped by the limits of the current scope (see Engine::SearchScope)
+     */
+    bool search_stopped();
+
+    /**
+     * @brief Get the evaluation guess, used for ordering search in alfa/beta search
+     * 
+     * @return int previous evaluation of the position of longest depth or 0 if there is no information in the cache
+     */
+    int get_eval_guess(size_t hash, Cache* cache);
+
 
     /**
      * @brief Searches the position for all possible continuations
@@ -66,55 +184,242 @@ namespace Engine{
      * 
      * @param maxdepth maximal depth in halfmoves to search the position
      * 
-     * @param cache previous evaluations stored in hashmap. The elements are stored ad std::pair<int, int>.
-     * Where element.first is evaluation depth and element.second is the evaluation
+     * @param cache previous evaluations stored in hashmap. The elements are stored as Engine::CacheEntry
+     * (evaluation depth, the evaluation and whether it is exact or only a bound)
+     * 
+     * @param ply distance from the root of the search. Positions repeated in the game history (or drawn by fifty-move rule)
+     * are evaluated as draw everywhere except the root
+     *
+     * @param extensions number of half-moves by which the line can still be extended. A position in check with only one
+     * legal move is searched two half-moves deeper, so forced lines are searched beyond maxdepth
      */
-    int evaluate(Position* position, int maxdepth, Cache* cache, int alfa=-MATE, int beta=MATE);
+    int evaluate(Position* position, int maxdepth, Cache* cache, int alfa=-MATE, int beta=MATE, int ply=0, int extensions=MAX_EXTENSIONS);
 
     /**
      * @brief Evaluate the position iteratively, gradually increasing the depth of search. Due to the nature of search,
      * as we can use the evaluation from previous iteration to guess the order of search, it usually tends to be
      * faster than direct aprroach
+     *
+     * @param stats if not null, statistics of every iteration are added to it
      */
-    int iter_evaluate(Position* position, int maxdepth, Cache* cache);
+    int iter_evaluate(Position* position, int maxdepth, Cache* cache, SearchStats* stats=nullptr);
+
+    /**
+     * @brief Result of Engine::search
+     * 
+     */
+    struct SearchResult{
+
+        // evaluation of the last completed iteration (see Engine::evaluate), 0 if no iteration was completed
+        int eval = 0;
+
+        // depth of the last completed iteration
+        int depth = 0;
+
+        // true if the search was stopped by the limits before reaching the maximal depth
+        bool stopped = false;
+    };
+
+    /**
+     * @brief Iterated search (see Engine::iter_evaluate) within the limits. Iterations continue until the depth limit is reached,
+     * the search is stopped or the position is evaluated as the fastest mate. Without any limit, Engine::MAX_DEPTH is searched
+     * 
+     * @param stats if not null, statistics of every completed iteration are added to it
+     */
+    SearchResult search(Position* position, Cache* cache, const SearchLimits& limits, SearchStats* stats=nullptr);
+
+    /**
+     * @brief un-does the last move of the position and searches the previous position, reusing the search of the position.
+     * Used to walk a game back from a mate (see Engine::generate_puzzle_by_playing): the un-done move is searched first
+     * and the window is bounded by the mate of the position (the previous position is at least as good for the player to move
+     * as the un-done move), so the previous position costs about as much as the moves not searched yet
+     *
+     * @param eval evaluation of the position (see Engine::evaluate), a mate
+     *
+     * @return evaluation of the previous position searched to maxdepth if it is a mate of the same side as eval, 0 otherwise
+     */
+    int undo_and_evaluate(Position* position, int maxdepth, int eval, Cache* cache);
 
     /**
      * @brief search for the fastest mate.
      *  
+     * @param stats if not null, statistics of every iteration are added to it
+     *
      * @return std::string representing the evaluation (e.g. "White mates in 3" or "Unknown result")
      */
-    std::string find_fastest_mate(Position* position, int max_moves, Cache* cache);
+    std::string find_fastest_mate(Position* position, int max_moves, Cache* cache, SearchStats* stats=nullptr);
+
+    /**
+     * @brief returns true if the mate evaluation of the position searched to given depth is the fastest mate: it is at most
+     * depth + 1 half-moves long (the shorter mates are searched to the full width) or it is stored in the cache as proven
+     * (see Engine::evaluate, longer mates may be found thanks to extensions, while a shorter mate exists)
+     */
+    bool is_fastest_mate(Position* position, int eval, int depth, Cache* cache);
+
+    /**
+     * @brief search for the fastest mate (of any side) within max_moves moves, gradually increasing the depth by one half-move
+     * 
+     * @return evaluation of the position (see Engine::evaluate), mate score if a mate within max_moves moves was found
+     * (0 if only a longer mate was found thanks to extensions, in the cache or in the tablebase)
+     */
+    int find_mate(Position* position, int max_moves, Cache* cache);
+
+    /**
+     * @brief returns the number of moves to mate for mate evaluation (e.g. 2 for both MATE - 3 and -(MATE - 4)), 0 for other evaluations
+     * 
+     */
+    int moves_to_mate(int eval);
+
+    /**
+     * @brief returns the line of best moves found by search of given depth. If there are more best moves, the first one found
+     * is chosen, so the result is deterministic. The position is not changed.
+     * 
+     */
+    std::vector<Move> get_principal_variation(Position* position, int depth, Cache* cache);
+
+    /**
+     * @brief Multi-PV search. Evaluates every legal move of the position by a search of given depth in one pass
+     * (the children are searched iteratively and share the cache, so the evaluations of the previous moves help ordering of the next ones)
+     * 
+     * @param lower_limit evaluations (from the point of view of the player to move) of moves, which are worse than lower_limit,
+     * are only upper bounds. Such moves are refuted by a cheap null-window search. Use -MATE to get exact evaluations of all moves
+     * 
+     * @return all legal moves with their evaluations (from white's point of view, already processed by Engine::process_eval,
+     * so the evaluation of the best move is the evaluation of the position)
+     */
+    std::vector<std::pair<Move, int>> evaluate_moves(Position* position, int depth, Cache* cache, int lower_limit=-MATE);
+
+    /**
+     * @brief returns all moves with the best evaluation of given depth. The position is searched first, then all moves
+     * are evaluated by one multi-PV search (see Engine::evaluate_moves) with the evaluation of the position as the lower limit
+     * 
+     */
+    std::vector<Move> get_best_moves(Position* position, int depth, Cache* cache);
 
     /**
      * @brief plays a move with the best evaluation with specified depth.
      * If there are more moves with the best evaluation, choose one at random
      * 
-     * Uses std::random_shuffle, thus can be seeded by srand()
+     * The best moves are found by one multi-PV search (see Engine::get_best_moves), uses rand(), thus can be seeded by srand()
      * 
      * If the position is mate or stalemate, return without perfoming any changes to the position
-     * 
-     * Throws const char* if internal logic error is encountered
      */
     void play_random_best(Position* position, int max_depth, Cache* cache);
 
+    /**
+     * @brief What to do with puzzles, which have more than one solution (see Engine::has_unique_solution)
+     * 
+     */
+    enum class DualSolutions{
+        ALLOW,  // do not check the uniqueness of the solution
+        MARK,   // check the uniqueness and store the result in GenerationReport::unique_solution
+        REJECT  // generate another puzzle if the solution is not unique
+    };
+
+    /**
+     * @brief Settings of the puzzle generation
+     * 
+     */
+    struct GenerationOptions{
+        DualSolutions dual_solutions = DualSolutions::ALLOW;
+
+        // if true, GenerationReport::solution is filled with all solutions of the puzzle
+        bool build_solution_tree = false;
+
+        // if not nullptr, puzzles (and decisive positions of the games) found in the index are skipped and new ones are added
+        DedupIndex* dedup = nullptr;
+
+        // if not nullptr, the generator regularly lets the log write the statistics (see Engine::statistics)
+        StatisticsLog* statistics_log = nullptr;
+
+        // budget of one game (its time and searched nodes), the game is abandoned when the budget is exhausted and a new game is played.
+        // If the token of the limits is cancelled, the generation stops (see GenerationReport::cancelled).
+        // The depth of the limits is ignored, the generator searches to its own depths
+        SearchLimits game_limits;
+
+        // budget of the whole puzzle (all its games). When it is exhausted, the generation restarts with a new budget
+        // and (if there is a seed) from a seed derived from the given one, so the puzzle still depends only on the seed and the budget.
+        // The depth of the limits is ignored as in game_limits
+        SearchLimits puzzle_limits;
+
+        // if not nullptr (and not empty), every game starts from a position of the pool chosen at random (deterministically by the seed)
+        // instead of the initial position
+        StartPool* start_pool = nullptr;
+    };
+
+    /**
+     * @brief Information about generated puzzle
+     * 
+     */
+    struct GenerationReport{
+
+        // false if the attacker had more mating moves at some step of the solution (checked only if dual solutions are not allowed)
+        bool unique_solution = true;
+
+        // all solutions of the puzzle (built only if GenerationOptions::build_solution_tree is set)
+        SolutionTree solution;
+
+        // number of games thrown away because they led to an already known puzzle (see GenerationOptions::dedup)
+        int duplicates = 0;
+
+        // number of games abandoned because their budget was exhausted (see GenerationOptions::game_limits)
+        int abandoned_games = 0;
+
+        // number of restarts of the generation because the budget of the puzzle was exhausted (see GenerationOptions::puzzle_limits)
+        int puzzle_restarts = 0;
+
+        // true if the generation was stopped by the cancellation token (or by exhausted limits of an outer Engine::SearchScope),
+        // the returned position is not a puzzle
+        bool cancelled = false;
+    };
+
     /**
      * @brief generates a puzzle by letting the engine play itself.
      * 
-     * @param max_moves max moves complexity of the puzzle to be generated (usually the puzzles are 2 or 3 moves long at max, exceptionally 4). 
-     * This is due to setting the Engine::MAX_DEPTH to 5. Changing this setting may yield harder puzzles, but exponential performance change.
+     * @param max_moves max moves complexity of the puzzle to be generated (usually the puzzles are 2 to 4 moves long at max, exceptionally 5). 
+     * This is due to setting the Engine::MAX_DEPTH to 5, forced lines reach deeper thanks to extensions (see Engine::MAX_EXTENSIONS).
+     * Changing these settings may yield harder puzzles, but exponential performance change.
      * 
      * @param verbose if true, the process reports the current state of generation into std::cout
      * @param seed value used to generate the puzzles. Same seeds will return same puzzles.
      * If there is any seed given, the cache gets reseted (cleared) before generating the puzzle to ensure deterministic result
      * 
+     * @param options additional settings of the generation (see Engine::GenerationOptions)
+     * @param report if not nullptr, filled with information about the generated puzzle
+     * 
      * @return Position the puzzle
      */
-    Position generate_puzzle_by_playing(Cache* cache, int max_moves, bool verbose=true, std::string seed = "");
+    Position generate_puzzle_by_playing(Cache* cache, int max_moves, bool verbose=true, std::string seed = "",
+        GenerationOptions options = GenerationOptions(), GenerationReport* report = nullptr);
 
     /**
      * @brief return true if the given move is the best move in the position (there can be more best moves)
      * 
+     * To check more moves in the same position, compute Engine::get_best_moves once and look the moves up there.
      */
     bool is_solution(Position* puzzle, Move move, Cache* cache);
 
-}
+    /**
+     * @brief returns moves of the player to move, which mate at least as fast as the best move (at most max_count moves are returned).
+     * The position has to be evaluated as mate for the player to move.
+     * 
+     * Each move is tested by zero-window search around the mate score, which is cheap, as it mostly reuses the cache.
+     */
+    std::vector<Move> get_mating_moves(Position* position, Cache* cache, int max_count=__INT_MAX__);
+
+    /**
+     * @brief checks that the attacker has exactly one fastest mating move at each step of the solution,
+     * after every best defense (all defenses, which delay the mate the most, are followed)
+     * 
+     * @return true if the puzzle has single solution (false also if no mating move is found, although the puzzle is evaluated as mate)
+     */
+    bool has_unique_solution(Position* puzzle, Cache* cache);
+
+    /**
+     * @brief builds tree of all solutions of the puzzle (all fastest mating moves of the attacker and all best defenses)
+     * The puzzle has to be evaluated as mate.
+     * 
+     */
+    SolutionTree build_solution_tree(Position* puzzle, Cache* cache);
+
+}
\ No newline at end of file
@@ -1,6 +1,16 @@
 #include "engine.h"
+#include "solver.h"
+#include "tablebase.h"
+#include "puzzle_db.h"
+#include "benchmark.h"
+#include "selfcheck.h"
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <sys/stat.h>
 
 std::string STARTUP_MSG = 
 "Welcome to the Chess puzzle generator! An iteractive chess puzzle tool.\n"
@@ -9,10 +19,85 @@ std::string STARTUP_MSG =
 "(for example http://www.ee.unb.ca/cgi-bin/tervo/fen.pl). While solving, please enter the\n"
 "moves in standard Long algebraic notation (e.g. Ra1-d1, Re7xe8, e2-e4, d7xe8=D)\n";
 
+// directory with tablebase files, relative to the working directory
+std::string TABLEBASE_DIRECTORY = "tablebases";
+
+std::string USAGE_MSG =
+"Usage:\n"
+"  tactics                                      interactive puzzle generation and solving\n"
+"  tactics solve [file|-] [max_moves] [threads]  solve EPD/FEN positions (one per line) for mate\n"
+"  tactics mate <FEN> [max_moves]               search the position for the fastest mate and print search statistics\n"
+"                                               of every iteration\n"
+"  tactics tb-build [signatures...]             build endgame tablebases (e.g. KRvK KQvKR, all 3-4 piece tables by default)\n"
+"  tactics generate <db_file> <count> [max_moves] [seed] [dedup_file]\n"
+"                                               generate puzzles into binary puzzle database, puzzles already\n"
+"                                               stored in dedup_file (by any run) are skipped\n"
+"                                               --stats=<file|-> writes statistics as JSON lines every\n"
+"                                               --stats-interval=<seconds> (10 by default)\n"
+"                                               --game-time=<seconds> and --game-nodes=<n> limit one game,\n"
+"                                               games over the budget are abandoned\n"
+"                                               --puzzle-time=<seconds> and --puzzle-nodes=<n> limit one puzzle,\n"
+"                                               over the budget the puzzle restarts from a derived seed\n"
+"                                               --start-pool=<file> starts games from FENs of the file (generated\n"
+"                                               and saved into the file, if it does not exist)\n"
+"  tactics db <db_file> [mate_moves] [material] list puzzles of the database (e.g. tactics db puzzles.db 3 KQRvKR)\n"
+"  tactics bench [seeds] [max_moves...]        generate puzzles for fixed seeds (10 by default) and max moves (2 3 by default),\n"
+"                                               print time, latency percentiles, nodes and checksum of the puzzles\n"
+"  tactics microbench [puzzles] [min_time]      time functions of Position over fixed positions and positions of\n"
+"                                               generated puzzles (4 by default), writes JSON lines\n"
+"  tactics selfcheck [games] [seed]             compare move generators and check detection with performing the moves\n"
+"                                               over random games (100 by default), exits with 1 on any mismatch\n"
+"\n"
+"Tablebases are loaded from directory \"" + TABLEBASE_DIRECTORY + "\" (if it exists).\n";
+
 int get_number_of_moves_from_user();
 Move get_move_from_user(std::vector<Move> possible_moves);
+int solve_mode(int argc, char** argv);
+int mate_mode(int argc, char** argv);
+int tablebase_build_mode(int argc, char** argv);
+int generate_mode(int argc, char** argv);
+int database_mode(int argc, char** argv);
+int microbench_mode(int argc, char** argv);
+int bench_mode(int argc, char** argv);
+int selfcheck_mode(int argc, char** argv);
+
+int main(int argc, char** argv){
+
+    try{
+        Tablebase::load(TABLEBASE_DIRECTORY);
+    } catch (const char* ex){
+        std::cerr << "Tablebases not loaded: " << ex << std::endl;
+    }
 
-int main(){
+    if(argc > 1){
+        std::string mode = argv[1];
+        if(mode == "solve"){
+            return solve_mode(argc, argv);
+        }
+        if(mode == "mate"){
+            return mate_mode(argc, argv);
+        }
+        if(mode == "tb-build"){
+            return tablebase_build_mode(argc, argv);
+        }
+        if(mode == "generate"){
+            return generate_mode(argc, argv);
+        }
+        if(mode == "db"){
+            return database_mode(argc, argv);
+        }
+        if(mode == "microbench"){
+            return microbench_mode(argc, argv);
+        }
+        if(mode == "bench"){
+            return bench_mode(argc, argv);
+        }
+        if(mode == "selfcheck"){
+            return selfcheck_mode(argc, argv);
+        }
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
 
     // Provide basic infromation and get parameters from user
 
@@ -29,51 +114,61 @@ int main(){
     auto cache = Cache();
     for(int puzzle_number = 0;; puzzle_number++){
 
-        Position puzzle = Engine::generate_puzzle_by_playing(&cache, max_moves, true, seed + "_" + std::to_string(puzzle_number));
+        Engine::GenerationOptions options;
+        options.dual_solutions = Engine::DualSolutions::MARK;
+        options.build_solution_tree = true;
+        Engine::GenerationReport report;
+        Position puzzle = Engine::generate_puzzle_by_playing(&cache, max_moves, true, seed + "_" + std::to_string(puzzle_number), options, &report);
         std::cout << std::endl;
         std::cout << "puzzle No. " << puzzle_number << "  with seed: " <<  seed + "_" + std::to_string(puzzle_number) << std::endl;
         std::cout << "FEN: " << puzzle.get_fen() << std::endl;
+        if(!report.unique_solution){
+            std::cout << "Note: the puzzle has more than one solution" << std::endl;
+        }
 
         // How many times user can be wrong in each puzzle before we show them a solution
         int corrections_left = 3;
 
-        while (abs(Engine::evaluate(&puzzle, Engine::MAX_DEPTH, &cache)) != Engine::MATE){
+        // All solutions were found during generation, the user is checked against the tree without any search
+        SolutionTree& solution = report.solution;
+        int node = 0;
+        int plies_to_mate = solution.m_plies_to_mate;
+        char attacker = puzzle.m_to_move;
+
+        while (!solution.is_leaf(node)){
             // Until the puzzle is solved (to mate)
 
             std::cout << puzzle.to_string() << std::endl;
-            std::cout << Engine::find_fastest_mate(&puzzle, Engine::MAX_DEPTH, &cache) << std::endl;
+            std::cout << (attacker == 'w' ? "White" : "Black") << " mates in " << (plies_to_mate + 1) / 2 << std::endl;
 
             auto possible_moves = puzzle.get_possible_moves();
 
             // User has to enter next move of their solution
             Move selected_move = get_move_from_user(possible_moves);
 
-            if(Engine::is_solution(&puzzle, selected_move, &cache)){
+            int child = solution.find_child(node, selected_move);
+            if(child != -1){
                 // User's chosen move leads to fastest mate
                 std::cout << "Correct! " << std::endl;
-                puzzle.perform_move(selected_move);
-
-                if(abs(Engine::evaluate(&puzzle, Engine::MAX_DEPTH, &cache)) != Engine::MATE){
-                    // If the puzzle has a continuation, play move for defending side
-                    Engine::play_random_best(&puzzle, Engine::MAX_DEPTH, &cache);
-                    std::cout << "Opponent played: " << puzzle.m_prev_moves.back().to_full_string() << std::endl;
-                }
+            } else if(corrections_left > 0){
+                // We won't show user the solution, until he has some corrections left
+                std::cout << "Wrong! Try again. " << --corrections_left  << " corrections left" << std::endl;
+                continue;
             } else {
-                // User's chosen move doesn't lead to fastest mate
-                if(corrections_left > 0){
-                    // We won't show user the solution, until he has some corrections left
-                    std::cout << "Wrong! Try again. " << --corrections_left  << " corrections left" << std::endl;
-                } else {
-                    // Show the user next solution move
-                    Engine::play_random_best(&puzzle, Engine::MAX_DEPTH, &cache);
-                    std::cout << "The solution was: " << puzzle.m_prev_moves.back().to_full_string() << std::endl;
-
-                    if(abs(Engine::evaluate(&puzzle, Engine::MAX_DEPTH, &cache)) != Engine::MATE){
-                        // If the puzzle has a continuation, play move for defending side
-                        Engine::play_random_best(&puzzle, Engine::MAX_DEPTH, &cache);
-                        std::cout << "Opponent played: " << puzzle.m_prev_moves.back().to_full_string() << std::endl;
-                    }
-                }
+                // Show the user next solution move
+                child = solution.random_child(node);
+                std::cout << "The solution was: " << solution.m_nodes[child].move.to_full_string() << std::endl;
+            }
+            puzzle.perform_move(solution.m_nodes[child].move);
+            node = child;
+            plies_to_mate--;
+
+            if(!solution.is_leaf(node)){
+                // If the puzzle has a continuation, play move for defending side
+                node = solution.random_child(node);
+                puzzle.perform_move(solution.m_nodes[node].move);
+                plies_to_mate--;
+                std::cout << "Opponent played: " << puzzle.last_move().to_full_string() << std::endl;
             }
         }
     }
@@ -117,4 +212,314 @@ Move get_move_from_user(std::vector<Move> possible_moves){
         }
         std::cout << std::endl;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief tactics solve [file|-] [max_moves] [threads]
+ * 
+ * Reads positions from the file (or standard input if the file is "-" or not given) and writes solutions to standard output
+ */
+int solve_mode(int argc, char** argv){
+    std::string path = argc > 2 ? argv[2] : "-";
+    int max_moves = 3;
+    int threads = std::thread::hardware_concurrency();
+    try{
+        if(argc > 3){
+            max_moves = std::stoi(argv[3]);
+        }
+        if(argc > 4){
+            threads = std::stoi(argv[4]);
+        }
+    } catch (std::exception& ex){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    if(path == "-"){
+        Solver::solve_stream(std::cin, std::cout, max_moves, threads);
+        return 0;
+    }
+    std::ifstream file(path);
+    if(!file){
+        std::cerr << "Cannot open " << path << std::endl;
+        return 1;
+    }
+    Solver::solve_stream(file, std::cout, max_moves, threads);
+    return 0;
+}
+
+/**
+ * @brief tactics mate <FEN> [max_moves]
+ * 
+ * Searches the position for the fastest mate (see Engine::find_fastest_mate) and prints the result with statistics of every iteration
+ */
+int mate_mode(int argc, char** argv){
+    if(argc < 3){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    int max_moves = 5;
+    try{
+        if(argc > 3){
+            max_moves = std::stoi(argv[3]);
+        }
+    } catch (std::exception& ex){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    try{
+        Position position(argv[2]);
+        auto cache = Cache();
+        Engine::SearchStats stats;
+        std::cout << Engine::find_fastest_mate(&position, max_moves, &cache, &stats) << std::endl;
+        std::cout << stats.to_string();
+    } catch (const char* ex){
+        std::cerr << ex << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief tactics tb-build [signatures...]
+ * 
+ * Builds given tablebases (or all supported tablebases) into TABLEBASE_DIRECTORY
+ */
+int tablebase_build_mode(int argc, char** argv){
+    auto signatures = std::vector<std::string>(argv + 2, argv + argc);
+    if(signatures.empty()){
+        signatures = Tablebase::all_signatures();
+    }
+    mkdir(TABLEBASE_DIRECTORY.c_str(), 0755);
+    try{
+        for(auto& signature : signatures){
+            Tablebase::build(signature, TABLEBASE_DIRECTORY);
+        }
+    } catch (const char* ex){
+        std::cerr << ex << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief tactics generate <db_file> <count> [max_moves] [seed] [dedup_file]
+ * 
+ * Generates count puzzles (with seeds seed_0, seed_1, ...) and stores them with their solutions into binary puzzle database.
+ * If dedup_file is given, puzzles found in it are skipped and the new puzzles are added to it.
+ * 
+ * Options: --stats=<file|-> writes generation statistics as JSON lines to the file (or standard error),
+ * --stats-interval=<seconds> sets time between two lines (10 seconds by default),
+ * --game-time=<seconds> and --game-nodes=<n> limit the search of one game (see Engine::GenerationOptions::game_limits),
+ * --puzzle-time=<seconds> and --puzzle-nodes=<n> limit the search of one puzzle (see Engine::GenerationOptions::puzzle_limits),
+ * --start-pool=<file> starts the games from the positions of the file (see StartPool), if the file does not exist,
+ * the pool is generated and saved into it
+ */
+int generate_mode(int argc, char** argv){
+    // options may be given anywhere after the mode, the other arguments are positional
+    auto args = std::vector<std::string>();
+    std::string stats_path;
+    double stats_interval = 10;
+    Engine::SearchLimits game_limits;
+    Engine::SearchLimits puzzle_limits;
+    std::string start_pool_path;
+    int count;
+    int max_moves = 3;
+    try{
+        for(int i = 0; i < argc; i++){
+            std::string arg = argv[i];
+            if(arg.rfind("--stats=", 0) == 0){
+                stats_path = arg.substr(8);
+            } else if(arg.rfind("--stats-interval=", 0) == 0){
+                stats_interval = std::stod(arg.substr(17));
+            } else if(arg.rfind("--game-time=", 0) == 0){
+                game_limits.time = std::stod(arg.substr(12));
+            } else if(arg.rfind("--game-nodes=", 0) == 0){
+                game_limits.nodes = std::stoull(arg.substr(13));
+            } else if(arg.rfind("--puzzle-time=", 0) == 0){
+                puzzle_limits.time = std::stod(arg.substr(14));
+            } else if(arg.rfind("--puzzle-nodes=", 0) == 0){
+                puzzle_limits.nodes = std::stoull(arg.substr(15));
+            } else if(arg.rfind("--start-pool=", 0) == 0){
+                start_pool_path = arg.substr(13);
+            } else {
+                args.push_back(arg);
+            }
+        }
+        if(args.size() < 4){
+            std::cerr << USAGE_MSG;
+            return 1;
+        }
+        count = std::stoi(args[3]);
+        if(args.size() > 4){
+            max_moves = std::stoi(args[4]);
+        }
+    } catch (std::exception& ex){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    std::string seed = args.size() > 5 ? args[5] : "";
+    std::ofstream stats_file;
+    if(!stats_path.empty() && stats_path != "-"){
+        stats_file.open(stats_path, std::ios::app);
+        if(!stats_file){
+            std::cerr << "Cannot open " << stats_path << std::endl;
+            return 1;
+        }
+    }
+    Engine::StatisticsLog statistics_log(stats_path == "-" ? &std::cerr : &stats_file, stats_interval);
+    try{
+        PuzzleDB::Writer writer(args[2]);
+        auto dedup = args.size() > 6 ? DedupIndex(args[6]) : DedupIndex();
+        Engine::GenerationOptions options;
+        options.dedup = &dedup;
+        options.game_limits = game_limits;
+        options.puzzle_limits = puzzle_limits;
+        auto start_pool = start_pool_path.empty() ? StartPool() : StartPool(start_pool_path);
+        if(!start_pool_path.empty()){
+            if(start_pool.empty()){
+                // the pool is generated once, the next runs load it
+                std::cerr << "Generating start pool..." << std::endl;
+                start_pool.generate(START_POOL_SIZE, "start_pool");
+                start_pool.save();
+            }
+            options.start_pool = &start_pool;
+        }
+        if(!stats_path.empty()){
+            options.statistics_log = &statistics_log;
+        }
+        Engine::GenerationReport report;
+        auto cache = Cache();
+        for(int i = 0; i < count; i++){
+            auto start = std::chrono::steady_clock::now();
+            std::string puzzle_seed = seed + "_" + std::to_string(i);
+            Position puzzle = Engine::generate_puzzle_by_playing(&cache, max_moves, false, puzzle_seed, options, &report);
+            int eval = Engine::evaluate(&puzzle, Engine::MIN_DEPTH, &cache);
+            auto solution = Engine::get_principal_variation(&puzzle, Engine::MATE - abs(eval), &cache);
+            auto time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            writer.add(&puzzle, Engine::moves_to_mate(eval), solution, puzzle_seed, time);
+            std::cout << puzzle.get_fen() << std::endl;
+        }
+        writer.finish();
+        dedup.save();
+        std::cerr << report.duplicates << " duplicate puzzles skipped" << std::endl;
+        std::cerr << report.abandoned_games << " games abandoned" << std::endl;
+        std::cerr << report.puzzle_restarts << " puzzles restarted" << std::endl;
+        if(!stats_path.empty()){
+            statistics_log.write();
+        }
+    } catch (const char* ex){
+        std::cerr << ex << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief tactics db <db_file> [mate_moves] [material]
+ * 
+ * Lists puzzles of the database (all or only puzzles with given mate length and material) as FEN with the solution
+ */
+int database_mode(int argc, char** argv){
+    if(argc < 3){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    try{
+        PuzzleDB::Database database(argv[2]);
+        auto records = std::vector<uint32_t>();
+        if(argc > 3){
+            auto range = database.find(std::stoi(argv[3]), argc > 4 ? PuzzleDB::parse_material_signature(argv[4]) : 0);
+            records.assign(range.first, range.second);
+        } else {
+            for(uint64_t i = 0; i < database.size(); i++){
+                records.push_back(i);
+            }
+        }
+        for(auto i : records){
+            std::cout << database.get_position(i).get_fen() << " ; mate in " << (int)database.record(i).mate_moves << " ;";
+            for(auto m : database.get_solution(i)){
+                std::cout << " " << m.to_full_string();
+            }
+            std::cout << " ; seed " << database.seed(i) << std::endl;
+        }
+    } catch (const char* ex){
+        std::cerr << ex << std::endl;
+        return 1;
+    } catch (std::exception& ex){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief tactics microbench [puzzles] [min_time]
+ * 
+ * Runs micro-benchmarks of Position (see Benchmark::run_micro) and writes the results as JSON lines to standard output
+ */
+int microbench_mode(int argc, char** argv){
+    int puzzles = 4;
+    double min_time = 0.5;
+    try{
+        if(argc > 2){
+            puzzles = std::stoi(argv[2]);
+        }
+        if(argc > 3){
+            min_time = std::stod(argv[3]);
+        }
+    } catch (std::exception& ex){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    auto corpus = Benchmark::get_corpus(puzzles);
+    Benchmark::run_micro(std::cout, corpus, min_time);
+    return 0;
+}
+
+/**
+ * @brief tactics bench [seeds] [max_moves...]
+ * 
+ * Runs the deterministic generation benchmark (see Benchmark::run_generation) and writes the results to standard output
+ */
+int bench_mode(int argc, char** argv){
+    int seeds = 10;
+    auto max_moves = std::vector<int>();
+    try{
+        if(argc > 2){
+            seeds = std::stoi(argv[2]);
+        }
+        for(int i = 3; i < argc; i++){
+            max_moves.push_back(std::stoi(argv[i]));
+        }
+    } catch (std::exception& ex){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    if(max_moves.empty()){
+        max_moves = {2, 3};
+    }
+    Benchmark::run_generation(std::cout, seeds, max_moves);
+    return 0;
+}
+
+/**
+ * @brief tactics selfcheck [games] [seed]
+ * 
+ * Compares the generators of Position with the slow reference over random games (see SelfCheck::run)
+ */
+int selfcheck_mode(int argc, char** argv){
+    int games = 100;
+    std::string seed = "selfcheck";
+    try{
+        if(argc > 2){
+            games = std::stoi(argv[2]);
+        }
+        if(argc > 3){
+            seed = argv[3];
+        }
+    } catch (std::exception& ex){
+        std::cerr << USAGE_MSG;
+        return 1;
+    }
+    return SelfCheck::run(std::cout, games, seed) == 0 ? 0 : 1;
+}
@@ -25,6 +25,37 @@ Move::Move(int from, int to, char piece, char captured, char special, int last_e
 }
 
 
+// moves are equal if they have the same squares and special information (the other fields follow from the position)
+bool Move::operator==(const Move& other) const{
+    return m_from == other.m_from && m_to == other.m_to && m_special == other.m_special;
+}
+
+
+// returns true if the move takes a piece (including en-passant)
+bool Move::is_capture() const{
+    return m_captured != '.' || m_special == 'E' || m_special == 'e';
+}
+
+
+// returns true if the move is a promotion
+bool Move::is_promotion() const{
+    return m_special != 0 && m_special != 'E' && m_special != 'e';
+}
+
+
+/**
+ * @brief returns the move packed into 16 bits: from (bits 0-5), to (bits 6-11) and promotion (bits 12-14, index in ".QRBN").
+ * The other fields follow from the position (see Position::unpack_move). Packed move is never 0.
+ */
+uint16_t Move::pack() const{
+    int promotion = 0;
+    if(is_promotion()){
+        promotion = std::string(".QRBN").find(toupper(m_special));
+    }
+    return m_from | (m_to << 6) | (promotion << 12);
+}
+
+
 /**
  * @return the classic representation of the move as text using english caption of the pieces (R,N,B,Q,K) and no caption for pawn moves
  * 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
 std::string square_string(int square);
 
@@ -41,10 +42,28 @@ class Move{
         // en-passant from previous board state (used for correctly undoing moves)
         int m_last_enpassant;
 
+        // empty move with unspecified content, used as a placeholder in preallocated containers
+        Move() = default;
+
         // constructor
         Move(int from, int to, char piece, char captured, char special = (char)0, int last_enpassant=-1);
         
 
+        // moves are equal if they have the same squares and special information (the other fields follow from the position)
+        bool operator==(const Move& other) const;
+
+        // returns true if the move takes a piece (including en-passant)
+        bool is_capture() const;
+
+        // returns true if the move is a promotion
+        bool is_promotion() const;
+
+        /**
+         * @brief returns the move packed into 16 bits: from (bits 0-5), to (bits 6-11) and promotion (bits 12-14, index in ".QRBN").
+         * The other fields follow from the position (see Position::unpack_move). Packed move is never 0.
+         */
+        uint16_t pack() const;
+
         /**
          * @return the classic representation of the move as text using english caption of the pieces (R,N,B,Q,K) and no caption for pawn moves
          * 
@@ -0,0 +1,147 @@
+#include <vector>
+#include <algorithm>
+#include "position.h"
+#include "engine.h"
+#include "move_picker.h"
+
+namespace Engine{
+
+    // remembers the quiet move which caused a cutoff in given ply
+    void KillerTable::store(int ply, Move move){
+        if(ply >= MAX_KILLER_PLY || moves[ply][0] == move.pack()){
+            return;
+        }
+        moves[ply][1] = moves[ply][0];
+        moves[ply][0] = move.pack();
+    }
+
+    // returns the two killer moves of the ply (0 for no move)
+    const uint16_t* KillerTable::get(int ply){
+        static const uint16_t none[2] = {0, 0};
+        return ply < MAX_KILLER_PLY ? moves[ply] : none;
+    }
+
+    /**
+     * @brief value of the piece for ordering of captures (the king is the most valuable attacker)
+     */
+    int capture_order_value(char piece){
+        return tolower(piece) == 'k' ? 100 : abs(piece_value(piece));
+    }
+
+    /**
+     * @param tt_move packed move from the cache (see Move::pack) or 0
+     *
+     * @param killers two packed killer moves (see Engine::KillerTable) or nullptr
+     */
+    MovePicker::MovePicker(Position* position, Cache* cache, uint16_t tt_move, const uint16_t* killers){
+        m_position = position;
+        m_cache = cache;
+        m_stage = Stage::TT_MOVE;
+        m_tt_move = tt_move;
+        m_killers[0] = killers != nullptr ? killers[0] : 0;
+        m_killers[1] = killers != nullptr ? killers[1] : 0;
+        m_killer_index = 0;
+    }
+
+    // sets the next move and returns true, returns false if there are no more moves
+    bool MovePicker::next(Move* move){
+        while(true){
+            switch(m_stage){
+                case Stage::TT_MOVE:
+                    m_stage = Stage::GENERATE_CAPTURES;
+                    if(m_tt_move != 0){
+                        // the cached move may come from a colliding position, it has to be validated
+                        *move = m_position->unpack_move(m_tt_move);
+                        if(m_position->is_legal(*move)){
+                            m_tt_move = move->pack();
+                            return true;
+                        }
+                        m_tt_move = 0;
+                    }
+                    break;
+                case Stage::GENERATE_CAPTURES:
+                    m_moves.clear();
+                    for(auto m : m_position->get_possible_moves(MoveFilter::CAPTURES)){
+                        if(m.pack() == m_tt_move){
+                            continue;
+                        }
+                        // most valuable victim, least valuable attacker. Promotions count as capturing the new piece
+                        int victim = m.m_captured != '.' ? capture_order_value(m.m_captured) : (m.is_capture() ? 1 : 0);
+                        if(m.is_promotion()){
+                            victim += capture_order_value(m.m_special);
+                        }
+                        m_moves.push_back({100 * victim - capture_order_value(m.m_piece), m});
+                    }
+                    // sorted ascending, the best moves are taken from the back (for equal scores in the order of generation)
+                    std::reverse(m_moves.begin(), m_moves.end());
+                    std::stable_sort(m_moves.begin(), m_moves.end(), [](const std::pair<int, Move>& a, const std::pair<int, Move>& b){
+                        return a.first < b.first;
+                    });
+                    m_stage = Stage::CAPTURES;
+                    break;
+                case Stage::CAPTURES:
+                    if(!m_moves.empty()){
+                        *move = m_moves.back().second;
+                        m_moves.pop_back();
+                        return true;
+                    }
+                    m_stage = Stage::KILLERS;
+                    break;
+                case Stage::KILLERS:
+                    if(m_killer_index < 2){
+                        // killers come from other positions of the same ply, they have to be quiet and legal here.
+                        // The yielded killers are kept (packed from the legal move), the others are cleared
+                        uint16_t killer = m_killers[m_killer_index];
+                        m_killers[m_killer_index] = 0;
+                        if(killer != 0){
+                            *move = m_position->unpack_move(killer);
+                            uint16_t packed = move->pack();
+                            if(packed != m_tt_move && packed != m_killers[0] && !move->is_capture() && !move->is_promotion()
+                                && m_position->is_legal(*move)){
+                                m_killers[m_killer_index] = packed;
+                                m_killer_index++;
+                                return true;
+                            }
+                        }
+                        m_killer_index++;
+                        break;
+                    }
+                    m_stage = Stage::GENERATE_QUIETS;
+                    break;
+                case Stage::GENERATE_QUIETS:
+                    {
+                    m_moves.clear();
+                    int side = m_position->m_to_move == 'w' ? 1 : -1;
+                    for(auto m : m_position->get_possible_moves(MoveFilter::QUIETS)){
+                        uint16_t packed = m.pack();
+                        if(packed == m_tt_move || packed == m_killers[0] || packed == m_killers[1]){
+                            continue;
+                        }
+                        // guess the order by the previous evaluation of the resulting position (from the point of view of the player to move)
+                        m_position->perform_move(m);
+                        int guess = get_eval_guess(m_position->get_hash(), m_cache) * side;
+                        m_position->undo_move();
+                        m_moves.push_back({guess, m});
+                    }
+                    std::reverse(m_moves.begin(), m_moves.end());
+                    std::stable_sort(m_moves.begin(), m_moves.end(), [](const std::pair<int, Move>& a, const std::pair<int, Move>& b){
+                        return a.first < b.first;
+                    });
+                    m_stage = Stage::QUIETS;
+                    }
+                    break;
+                case Stage::QUIETS:
+                    if(!m_moves.empty()){
+                        *move = m_moves.back().second;
+                        m_moves.pop_back();
+                        return true;
+                    }
+                    m_stage = Stage::DONE;
+                    break;
+                case Stage::DONE:
+                    return false;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "position.h"
+#include "engine.h"
+#include <vector>
+#include <cstdint>
+
+namespace Engine{
+
+    // Killer moves are stored for plies 0 .. MAX_KILLER_PLY - 1
+    const int MAX_KILLER_PLY = 128;
+
+    /**
+     * @brief Two quiet moves per ply, which recently caused a beta cutoff (see Engine::MovePicker). Moves are packed (see Move::pack)
+     *
+     */
+    struct KillerTable{
+        uint16_t moves[MAX_KILLER_PLY][2] = {};
+
+        // remembers the quiet move which caused a cutoff in given ply
+        void store(int ply, Move move);
+
+        // returns the two killer moves of the ply (0 for no move)
+        const uint16_t* get(int ply);
+    };
+
+    /**
+     * @brief Yields legal moves of the position one by one in stages, so that moves are generated only when they are needed:
+     *
+     * 1. the move from the cache (best move of the previous search of the position), nothing is generated
+     * 2. captures and promotions, the most valuable victim first (and the least valuable attacker among them)
+     * 3. killer moves of the ply
+     * 4. the other (quiet) moves, ordered by evaluations of the resulting positions stored in the cache
+     *
+     * In a cut node the first moves usually cause the cutoff, so the quiet moves are never generated.
+     * Every legal move is yielded exactly once.
+     */
+    class MovePicker{
+
+        public:
+
+            /**
+             * @param tt_move packed move from the cache (see Move::pack) or 0
+             *
+             * @param killers two packed killer moves (see Engine::KillerTable) or nullptr
+             */
+            MovePicker(Position* position, Cache* cache, uint16_t tt_move, const uint16_t* killers);
+
+            // sets the next move and returns true, returns false if there are no more moves
+            bool next(Move* move);
+
+        private:
+            enum class Stage{
+                TT_MOVE,
+                GENERATE_CAPTURES,
+                CAPTURES,
+                KILLERS,
+                GENERATE_QUIETS,
+                QUIETS,
+                DONE
+            };
+
+            Position* m_position;
+            Cache* m_cache;
+            Stage m_stage;
+            uint16_t m_tt_move;
+
+            // killer moves, the yielded ones are kept so that they are skipped among the quiet moves
+            uint16_t m_killers[2];
+            int m_killer_index;
+
+            // generated moves of the current stage (sorted by the score, the best last) and their scores
+            std::vector<std::pair<int, Move>> m_moves;
+    };
+
+}
@@ -1,7 +1,9 @@
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include "move.h"
 #include "position.h"
 
@@ -47,6 +49,229 @@ int get_square(std::string str){
 }
 
 
+/**
+ * @brief returns material value of the piece (positive for white pieces, negative for black pieces, 0 for empty square '.')
+ * 
+ */
+int piece_value(char piece){
+    switch(piece){
+        case 'K': return 1000;
+        case 'Q': return 9;
+        case 'R': return 5;
+        case 'N': return 3;
+        case 'B': return 3;
+        case 'P': return 1;
+        case 'k': return -1000;
+        case 'q': return -9;
+        case 'r': return -5;
+        case 'n': return -3;
+        case 'b': return -3;
+        case 'p': return -1;
+        default: return 0;
+    }
+}
+
+
+/**
+ * @brief Random keys used for Zobrist hashing, generated by splitmix64 from a fixed seed so that hashes are the same in every run
+ * 
+ */
+struct ZobristKeys{
+    uint64_t pieces[12][64];
+    uint64_t en_passant[64];
+    uint64_t black_to_move;
+
+    ZobristKeys(){
+        uint64_t state = 0x43686573735461ULL;
+        auto next = [&state](){
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        };
+        for(int p = 0; p < 12; p++){
+            for(int sq = 0; sq < 64; sq++){
+                pieces[p][sq] = next();
+            }
+        }
+        for(int sq = 0; sq < 64; sq++){
+            en_passant[sq] = next();
+        }
+        black_to_move = next();
+    }
+};
+
+static const ZobristKeys zobrist;
+
+// value of Position::m_checkers (and StateDelta::checkers) if the checkers were not computed
+static const uint64_t UNKNOWN_CHECKERS = ~(uint64_t)0;
+
+
+/**
+ * @brief returns the step (difference of the squares) leading from square a towards square b if they lie on one rank, file
+ * or diagonal, otherwise 0
+ */
+static int line_step(int a, int b){
+    int cols = b % 8 - a % 8;
+    int rows = b / 8 - a / 8;
+    if(a == b || (cols != 0 && rows != 0 && abs(cols) != abs(rows))){
+        return 0;
+    }
+    return (rows > 0 ? 8 : (rows < 0 ? -8 : 0)) + (cols > 0 ? 1 : (cols < 0 ? -1 : 0));
+}
+
+
+/**
+ * @brief returns Zobrist key of the piece standing on the square
+ * 
+ */
+static uint64_t piece_key(char piece, int square){
+    int index;
+    switch(tolower(piece)){
+        case 'p': index = 0; break;
+        case 'n': index = 1; break;
+        case 'b': index = 2; break;
+        case 'r': index = 3; break;
+        case 'q': index = 4; break;
+        default: index = 5; break; // king
+    }
+    if(!is_upper(piece)){
+        index += 6;
+    }
+    return zobrist.pieces[index][square];
+}
+
+
+PieceList::PieceList(){
+    m_size = 0;
+    for(int i = 0; i < 64; i++){
+        m_index[i] = -1;
+    }
+}
+
+PieceList::iterator PieceList::begin(){
+    return m_items;
+}
+
+PieceList::iterator PieceList::end(){
+    return m_items + m_size;
+}
+
+size_t PieceList::size(){
+    return m_size;
+}
+
+// returns iterator to any piece of given type or end() if there is no such piece
+PieceList::iterator PieceList::find(char piece){
+    for(int i = 0; i < m_size; i++){
+        if(m_items[i].first == piece){
+            return m_items + i;
+        }
+    }
+    return end();
+}
+
+// returns iterator to the piece standing on given square or end() if the square is empty
+PieceList::iterator PieceList::at(int square){
+    if(m_index[square] == -1){
+        return end();
+    }
+    return m_items + m_index[square];
+}
+
+/**
+ * @brief adds the piece to the list
+ * 
+ * @throws const char* if there are more than 32 pieces
+ */
+void PieceList::insert(std::pair<char, int> piece){
+    if(m_size == 32){
+        throw "too many pieces on board";
+    }
+    m_items[m_size] = piece;
+    m_index[piece.second] = m_size;
+    m_size++;
+}
+
+// removes all pieces
+void PieceList::clear(){
+    for(int i = 0; i < m_size; i++){
+        m_index[m_items[i].second] = -1;
+    }
+    m_size = 0;
+}
+
+// removes the piece from the list
+void PieceList::erase(iterator piece){
+    int i = piece - m_items;
+    m_index[piece->second] = -1;
+    m_size--;
+    if(i != m_size){
+        // fill the gap by the last piece
+        m_items[i] = m_items[m_size];
+        m_index[m_items[i].second] = i;
+    }
+}
+
+// changes the square of the piece
+void PieceList::move(iterator piece, int square){
+    m_index[piece->second] = -1;
+    piece->second = square;
+    m_index[square] = piece - m_items;
+}
+
+
+UndoStack::UndoStack(){
+    m_size = 0;
+}
+
+UndoStack::UndoStack(const UndoStack& other){
+    m_size = other.m_size;
+    std::copy(other.m_items, other.m_items + other.m_size, m_items);
+}
+
+UndoStack& UndoStack::operator=(const UndoStack& other){
+    m_size = other.m_size;
+    std::copy(other.m_items, other.m_items + other.m_size, m_items);
+    return *this;
+}
+
+/**
+ * @throws const char* if more than MAX_GAME_PLY moves were played
+ */
+void UndoStack::push(const StateDelta& delta){
+    if(m_size == MAX_GAME_PLY){
+        throw "too many moves played on the board";
+    }
+    m_items[m_size] = delta;
+    m_size++;
+}
+
+// removes and returns last delta (the stack must not be empty)
+StateDelta UndoStack::pop(){
+    m_size--;
+    return m_items[m_size];
+}
+
+// last delta (the stack must not be empty)
+StateDelta& UndoStack::back(){
+    return m_items[m_size - 1];
+}
+
+// i-th delta from the bottom of the stack
+StateDelta& UndoStack::operator[](int i){
+    return m_items[i];
+}
+
+int UndoStack::size(){
+    return m_size;
+}
+
+void UndoStack::clear(){
+    m_size = 0;
+}
+
+
 // returns printable string representing the current board state
 std::string Position::to_string(){
     std::string txt = "#  a b c d e f g h  #\n\n";
@@ -69,63 +294,293 @@ std::string Position::to_string(){
 
 
 /**
- * @brief eturns 64-bit hash representing the board state (the hash changes if a move is played on the board).
+ * @brief returns 64-bit hash representing the board state (the hash changes if a move is played on the board).
  * A position instance thus cannot be used as a key in std::unordered_map. The hash is used in evaluation in lookup table.
  * 
+ * The hash is Zobrist hash updated incrementally in perform_move() and restored in undo_move().
  * Hash collisions may appear, but i think it should be too rare to handle.
  */
 size_t Position::get_hash(){
-    std::size_t h1 = std::hash<std::string>{}(m_board);
-    std::size_t h2 = std::hash<int>{}(m_en_passant);
-    std::size_t h3 = std::hash<char>{}(m_to_move);
-    return h1 ^ (h2 << 1) ^ (h3 << 2);
+    return m_hash;
 }
 
 
 /**
- * @brief Returns new Position represented by given FEN string (see https://en.wikipedia.org/wiki/Forsyth%E2%80%93Edwards_Notation)
- * FEN notation is commonly used across chess software making it possible to easily import the position to other program
+ * @brief returns hash (see Position::get_hash()) of the position transformed by a symmetry of the board. Without castles
+ * the transformed position has the same content as the original one.
  * 
- * @throws std::exception May throw stdlib C/C++ exceptions / SEGFAULT if the FEN is invalid
+ * @param flip_colors the board is mirrored vertically (rank 1 <-> rank 8), pieces change colors and the other player is to move
+ * @param mirror_files the board is mirrored horizontally (file a <-> file h)
  */
-Position::Position(std::string FEN){
-    m_board[64] = '\0';
-    m_prev_moves = std::vector<Move>();
-    m_pieces = std::unordered_multimap<char, int>();
-    int i = 0;
-    int j = 0;
-    while(i < 64){
-        if(FEN[j] == '/'){
-            j++;
-        } else if('0' <= FEN[j] && FEN[j] <= '9'){
-            for(int k = 0; k < FEN[j] - '0'; k++){
-                m_board[i] = '.';
-                i++;
+size_t Position::get_symmetric_hash(bool flip_colors, bool mirror_files){
+    // mirroring ranks flips bits 3-5 of the square index, mirroring files bits 0-2
+    int mask = (flip_colors ? 56 : 0) | (mirror_files ? 7 : 0);
+    uint64_t hash = 0;
+    for(auto& piece : m_pieces){
+        char transformed = piece.first;
+        if(flip_colors){
+            transformed = is_upper(transformed) ? tolower(transformed) : toupper(transformed);
+        }
+        hash ^= piece_key(transformed, piece.second ^ mask);
+    }
+    if(m_en_passant != -1){
+        hash ^= zobrist.en_passant[m_en_passant ^ mask];
+    }
+    if((m_to_move == 'b') != flip_colors){
+        hash ^= zobrist.black_to_move;
+    }
+    return hash;
+}
+
+
+/**
+ * @brief returns the last played move (at least one move has to be played on the board)
+ */
+Move Position::last_move(){
+    return m_undo_stack.back().move;
+}
+
+
+// returns number of half-moves played on the board (and which can be un-done)
+int Position::ply(){
+    return m_undo_stack.size();
+}
+
+
+// returns number of half-moves played in the whole game (derived from the fullmove number, so it includes moves before the FEN)
+int Position::game_ply(){
+    return 2 * (m_fullmove_number - 1) + (m_to_move == 'b' ? 1 : 0);
+}
+
+
+/**
+ * @brief computes m_hash, m_material and m_kings from m_board and clears the cached checkers. Used by constructors
+ */
+void Position::init_state(){
+    m_undo_stack.clear();
+    m_checkers = UNKNOWN_CHECKERS;
+    m_check_squares_known = false;
+    m_hash = 0;
+    m_material = 0;
+    m_kings[0] = -1;
+    m_kings[1] = -1;
+    for(int sq = 0; sq < 64; sq++){
+        if(m_board[sq] == '.'){
+            continue;
+        }
+        m_hash ^= piece_key(m_board[sq], sq);
+        m_material += piece_value(m_board[sq]);
+        if(m_board[sq] == 'K'){
+            m_kings[0] = sq;
+        } else if(m_board[sq] == 'k'){
+            m_kings[1] = sq;
+        }
+    }
+    if(m_en_passant != -1){
+        m_hash ^= zobrist.en_passant[m_en_passant];
+    }
+    if(m_to_move == 'b'){
+        m_hash ^= zobrist.black_to_move;
+    }
+}
+
+
+/**
+ * @brief returns human readable description of the FEN parsing error
+ */
+const char* fen_error_string(FenError error){
+    switch(error){
+        case FenError::OK: return "ok";
+        case FenError::BAD_BOARD: return "invalid FEN: malformed board";
+        case FenError::BAD_SIDE_TO_MOVE: return "invalid FEN: side to move is not 'w' or 'b'";
+        case FenError::BAD_CASTLING: return "invalid FEN: malformed castling rights";
+        case FenError::BAD_EN_PASSANT: return "invalid FEN: en-passant square is inconsistent with the position";
+        case FenError::BAD_COUNTERS: return "invalid FEN: malformed halfmove clock or fullmove number";
+        case FenError::KING_COUNT: return "invalid FEN: each side must have exactly one king";
+        case FenError::TOO_MANY_PIECES: return "invalid FEN: too many pieces";
+        case FenError::PAWN_ON_BACK_RANK: return "invalid FEN: pawn on first or last rank";
+        case FenError::OPPONENT_IN_CHECK: return "invalid FEN: side not to move is in check";
+    }
+    return "invalid FEN";
+}
+
+
+/**
+ * @brief Parses FEN (see https://en.wikipedia.org/wiki/Forsyth%E2%80%93Edwards_Notation) into given position. Never throws.
+ * 
+ * Validates board shape, piece letters, king counts, pawns on back ranks, side to move, castling field (which is ignored),
+ * en-passant consistency and that the side not to move is not in check. Halfmove clock and fullmove number are optional.
+ * Trailing whitespace is allowed, anything else after the FEN is an error.
+ * 
+ * The parsing does not allocate memory, reusing one Position for many FENs is the fastest way to screen large files.
+ * 
+ * @return FenError::OK on success, otherwise the error (the position is left in unspecified, but valid for another parse_fen, state)
+ */
+FenError parse_fen(std::string_view fen, Position* position){
+    size_t j = 0;
+    size_t len = fen.length();
+    position->m_board[64] = '\0';
+    position->m_pieces.clear();
+
+    // Board and pieces
+    int row = 0;
+    int col = 0;
+    int white_pieces = 0;
+    int black_pieces = 0;
+    while(j < len && fen[j] != ' '){
+        char c = fen[j++];
+        if(c == '/'){
+            if(col != 8 || row == 7){
+                return FenError::BAD_BOARD;
+            }
+            row++;
+            col = 0;
+        } else if('1' <= c && c <= '8'){
+            if(col + (c - '0') > 8){
+                return FenError::BAD_BOARD;
+            }
+            for(int k = 0; k < c - '0'; k++){
+                position->m_board[8 * row + col++] = '.';
             }
-            j++;
         } else {
-            m_board[i] = FEN[j];
-            m_pieces.insert({FEN[j], i});
-            i++;
-            j++;
+            if(piece_value(c) == 0 || col == 8){
+                return FenError::BAD_BOARD;
+            }
+            if(tolower(c) == 'p' && (row == 0 || row == 7)){
+                return FenError::PAWN_ON_BACK_RANK;
+            }
+            if(++(is_upper(c) ? white_pieces : black_pieces) > 16){
+                return FenError::TOO_MANY_PIECES;
+            }
+            position->m_board[8 * row + col] = c;
+            position->m_pieces.insert({c, 8 * row + col});
+            col++;
         }
     }
+    if(row != 7 || col != 8){
+        return FenError::BAD_BOARD;
+    }
+
+    // to move
+    if(j + 2 > len || fen[j+1] == ' '){
+        return FenError::BAD_SIDE_TO_MOVE;
+    }
+    position->m_to_move = fen[j+1];
+    j += 2;
+    if((position->m_to_move != 'w' && position->m_to_move != 'b') || (j < len && fen[j] != ' ')){
+        return FenError::BAD_SIDE_TO_MOVE;
+    }
+
+    // castles (unused, only checked)
     j++;
-    m_to_move = FEN[j];
-    j+=2;
-    while(FEN[j] != ' '){
-        // skip castles (unused)
+    if(j >= len){
+        return FenError::BAD_CASTLING;
+    }
+    if(fen[j] == '-'){
         j++;
+    } else {
+        size_t start = j;
+        while(j < len && (fen[j] == 'K' || fen[j] == 'Q' || fen[j] == 'k' || fen[j] == 'q')){
+            j++;
+        }
+        if(j == start || j - start > 4){
+            return FenError::BAD_CASTLING;
+        }
     }
+    if(j < len && fen[j] != ' '){
+        return FenError::BAD_CASTLING;
+    }
+
+    // en-passant
     j++;
-    if(FEN[j] == '-'){
-        m_en_passant = -1;
+    if(j >= len){
+        return FenError::BAD_EN_PASSANT;
+    }
+    if(fen[j] == '-'){
+        position->m_en_passant = -1;
         j++;
     } else {
-        m_en_passant = get_square(FEN.substr(j, 2));
+        if(j + 1 >= len || !are_valid_coords(fen[j] - 'a', '8' - fen[j+1])){
+            return FenError::BAD_EN_PASSANT;
+        }
+        int sq = get_square(fen[j] - 'a', '8' - fen[j+1]);
+        // the pawn which has just moved by two squares stands in front of the en-passant square, the squares it passed are empty
+        int dir = position->m_to_move == 'w' ? 8 : -8;
+        char pawn = position->m_to_move == 'w' ? 'p' : 'P';
+        if(
+            sq / 8 != (position->m_to_move == 'w' ? 2 : 5) ||
+            position->m_board[sq] != '.' || position->m_board[sq - dir] != '.' || position->m_board[sq + dir] != pawn
+        ){
+            return FenError::BAD_EN_PASSANT;
+        }
+        position->m_en_passant = sq;
         j += 2;
     }
-    // skip halfmove count since last pawn move and capture as well as total move count (unused)
+
+    // halfmove count since last pawn move and capture and total move count (both optional)
+    int counters[2] = {0, 1};
+    for(int c = 0; c < 2 && j < len && fen[j] == ' '; c++){
+        while(j < len && fen[j] == ' '){
+            j++;
+        }
+        if(j == len){
+            break;
+        }
+        if(fen[j] < '0' || fen[j] > '9'){
+            return FenError::BAD_COUNTERS;
+        }
+        counters[c] = 0;
+        while(j < len && '0' <= fen[j] && fen[j] <= '9'){
+            if(counters[c] > 100000){
+                return FenError::BAD_COUNTERS;
+            }
+            counters[c] = 10 * counters[c] + (fen[j] - '0');
+            j++;
+        }
+    }
+    while(j < len && isspace((unsigned char)fen[j])){
+        j++;
+    }
+    if(j != len || counters[1] < 1){
+        return FenError::BAD_COUNTERS;
+    }
+    position->m_halfmove_clock = counters[0];
+    position->m_fullmove_number = counters[1];
+
+    // kings and check
+    position->init_state();
+    int kings[2] = {0, 0};
+    for(auto piece : position->m_pieces){
+        if(piece.first == 'K'){
+            kings[0]++;
+        } else if(piece.first == 'k'){
+            kings[1]++;
+        }
+    }
+    if(kings[0] != 1 || kings[1] != 1){
+        return FenError::KING_COUNT;
+    }
+    int waiting = position->m_to_move == 'w' ? 1 : 0;
+    if(position->square_hit(position->m_kings[waiting], waiting == 1)){
+        return FenError::OPPONENT_IN_CHECK;
+    }
+    return FenError::OK;
+}
+
+
+/**
+ * @brief Returns new Position represented by given FEN string (see https://en.wikipedia.org/wiki/Forsyth%E2%80%93Edwards_Notation)
+ * FEN notation is commonly used across chess software making it possible to easily import the position to other program
+ * 
+ * Halfmove clock and fullmove number are optional (default to 0 and 1). The parsing does not allocate memory.
+ * 
+ * @throws const char* if the FEN is invalid (see parse_fen() for non-throwing alternative)
+ */
+Position::Position(std::string_view FEN){
+    FenError error = parse_fen(FEN, this);
+    if(error != FenError::OK){
+        throw fen_error_string(error);
+    }
 }
 
 
@@ -136,7 +591,9 @@ Position::Position(std::string FEN){
  * @return std::string FEN representing the current position
  */
 std::string Position::get_fen(){
-    std::string result = std::string();
+    // longest FEN has 64 pieces + 7 slashes on the board + side, castles, en-passant and counters, fits easily
+    char result[128];
+    int len = 0;
     // Board and pieces
     int empty_buffer = 0;
     for(int i = 0; i < 64; i++){
@@ -144,36 +601,38 @@ std::string Position::get_fen(){
             empty_buffer++;
         } else {
             if(empty_buffer > 0){
-                result += std::to_string(empty_buffer);
+                result[len++] = '0' + empty_buffer;
                 empty_buffer = 0;
             }
-            result += m_board[i];
+            result[len++] = m_board[i];
         }
         if(i % 8 == 7){
             if(empty_buffer > 0){
-                result += std::to_string(empty_buffer);
+                result[len++] = '0' + empty_buffer;
                 empty_buffer = 0;
             }
             if(i != 63){
-                result += "/";
+                result[len++] = '/';
             }
         }
     }
-    result += " ";
-    // to move
-    result += m_to_move;
-    // castles (unsupported)
-    result += " - ";
+    // to move, castles (unsupported)
+    result[len++] = ' ';
+    result[len++] = m_to_move;
+    result[len++] = ' ';
+    result[len++] = '-';
+    result[len++] = ' ';
     // en-passant
     if(m_en_passant == -1){
-        result += "-";
+        result[len++] = '-';
     } else {
-        result += square_string(m_en_passant);
+        result[len++] = 'a' + m_en_passant % 8;
+        result[len++] = '8' - m_en_passant / 8;
     }
-    // half moves since last capture/pawn move, total moves (unsupported)
-    result += " 0 1";
+    // half moves since last capture/pawn move, total moves
+    len += snprintf(result + len, sizeof(result) - len, " %d %d", m_halfmove_clock, m_fullmove_number);
 
-    return result;
+    return std::string(result, len);
 }
 
 
@@ -191,8 +650,6 @@ Position::Position() : Position("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w K
  */
 Position::Position(std::vector<std::string> white_pieces, std::vector<std::string> black_pieces, char to_move, std::string en_passant_square){
     m_board[64] = '\0';
-    m_prev_moves = std::vector<Move>();
-    m_pieces = std::unordered_multimap<char, int>();
     for(int i = 0; i < 64; i++){
         m_board[i] = '.';
     }
@@ -224,6 +681,9 @@ Position::Position(std::vector<std::string> white_pieces, std::vector<std::strin
     } else {
         m_en_passant = -1;
     }
+    m_halfmove_clock = 0;
+    m_fullmove_number = 1;
+    init_state();
 }
 
 
@@ -317,27 +777,60 @@ bool Position::square_hit(int square, bool by_white){
 /**
  * @brief finds all legal moves in the current position for the player to move
  * 
+ * @param filter only moves of this kind are generated (e.g. captures first and quiet moves later, see Engine::MovePicker)
+ * 
  * @return std::vector<Move> possible moves
  */
-std::vector<Move> Position::get_possible_moves(){
+std::vector<Move> Position::get_possible_moves(MoveFilter filter){
     auto pseudo_legal = std::vector<Move>();
-    auto king = m_pieces.find(m_to_move == 'w' ? 'K' : 'k'); // Store pointer to king to validate moves
-    for(auto piece : m_pieces){
-        if(is_upper(piece.first) != (m_to_move == 'w')){
-            // The piece belongs to player which is not on the move
+    if(in_check()){
+        // in check only the moves which may resolve the check are generated
+        pseudo_legal = find_evasions();
+    } else {
+        for(auto piece : m_pieces){
+            if(is_upper(piece.first) != (m_to_move == 'w')){
+                // The piece belongs to player which is not on the move
+                continue;
+            }
+            for(auto move : find_pseudo_legal_moves(piece.first, piece.second, filter)){
+                // get pseudo-legal moves of the requested kind for the piece and add them to the list
+                pseudo_legal.push_back(move);
+            }
+        }
+    }
+    // the moves are validated after the generation, as performing and un-doing a capture changes the order of m_pieces
+    auto legal_moves = std::vector<Move>();
+    for(auto move : pseudo_legal){
+        if(filter != MoveFilter::ALL && (move.is_capture() || move.is_promotion()) != (filter == MoveFilter::CAPTURES)){
+            // the evasion is not of the requested kind (the other moves are generated by kind)
             continue;
         }
-        for(auto move : find_pseudo_legal_moves(piece.first, piece.second)){
-            // get all pseudo-legal moves for the piece and add them to the list
-            pseudo_legal.push_back(move);
+        if(is_legal_pseudo_legal(move)){
+            legal_moves.push_back(move);
+        }
+    }
+    return legal_moves;
+}
+
+
+/**
+ * @brief finds all legal moves by performing every pseudo-legal move of every piece of the player to move and testing
+ * the king by square_hit. Slow reference for the generators of the position (see SelfCheck::run), not used by the engine
+ */
+std::vector<Move> Position::get_possible_moves_by_trying(){
+    int own = m_to_move == 'w' ? 0 : 1;
+    auto pseudo_legal = std::vector<Move>();
+    for(auto piece : m_pieces){
+        if(is_upper(piece.first) == (own == 0)){
+            for(auto move : find_pseudo_legal_moves(piece.first, piece.second)){
+                pseudo_legal.push_back(move);
+            }
         }
     }
     auto legal_moves = std::vector<Move>();
     for(auto move : pseudo_legal){
         perform_move(move);
-        // do the move on the board
-        if(!square_hit(king->second, !is_upper(king->first))){
-            // look if plyer's king would be hit by opponent's piece
+        if(m_kings[own] == -1 || !square_hit(m_kings[own], own == 1)){
             legal_moves.push_back(move);
         }
         undo_move();
@@ -347,35 +840,256 @@ std::vector<Move> Position::get_possible_moves(){
 
 
 /**
- * @brief Get iterator to given piece at given square in m_pieces
+ * @brief finds all legal moves of the player to move which give check (directly or by discovery).
  * 
- * @return std::unordered_multimap<char, int>::iterator iterator to the piece or m_pieces.end() if not found
+ * Only the moves which give check are performed (to test their legality), the others are rejected by
+ * the check squares of the position (see Position::get_check_squares)
+ */
+std::vector<Move> Position::get_checking_moves(){
+    auto checking = std::vector<Move>();
+    const CheckSquares& check_squares = get_check_squares();
+    if(check_squares.king == -1){
+        return checking;
+    }
+    bool white = m_to_move == 'w';
+    if(in_check()){
+        // in check only the evasions can be played
+        for(auto move : find_evasions()){
+            if(gives_check(move)){
+                checking.push_back(move);
+            }
+        }
+    } else {
+        for(auto piece : m_pieces){
+            if(is_upper(piece.first) != white || (tolower(piece.first) == 'k' && (check_squares.discoverers & ((uint64_t)1 << piece.second)) == 0)){
+                // the king can give check only by discovery
+                continue;
+            }
+            for(auto move : find_pseudo_legal_moves(piece.first, piece.second)){
+                if(gives_check(move)){
+                    checking.push_back(move);
+                }
+            }
+        }
+    }
+    // the moves are validated after the generation, as performing and un-doing a capture changes the order of m_pieces
+    auto legal_moves = std::vector<Move>();
+    for(auto move : checking){
+        if(is_legal_pseudo_legal(move)){
+            legal_moves.push_back(move);
+        }
+    }
+    return legal_moves;
+}
+
+
+/**
+ * @brief returns the squares from which the pieces of the player to move would give check and the pieces
+ * which would give discovered check by moving away. Computed once per position (until a move is performed or un-done)
  */
-std::unordered_multimap<char, int>::iterator Position::get_piece(char piece, int square){
-    auto range = m_pieces.equal_range(piece);
-    for(auto ptr = range.first; ptr != range.second; ptr++){
-        if(ptr->second == square){
-            return ptr;
+const CheckSquares& Position::get_check_squares(){
+    CheckSquares& result = m_check_squares;
+    if(m_check_squares_known){
+        return result;
+    }
+    m_check_squares_known = true;
+    result = {};
+    bool white = m_to_move == 'w';
+    result.king = m_kings[white ? 1 : 0];
+    if(result.king == -1){
+        return result;
+    }
+    int col = result.king % 8;
+    int row = result.king / 8;
+    for(int c_dir : {1, -1}){
+        // own pawns hit the king from the row below it (white) or above it (black)
+        int pawn_row = row + (white ? 1 : -1);
+        if(are_valid_coords(col+c_dir, pawn_row)){
+            result.direct[0] |= (uint64_t)1 << get_square(col+c_dir, pawn_row);
+        }
+    }
+    for(std::pair<int,int> cds : (std::pair<int,int>[]) {{1,2},{2,1},{-1,2},{-2,1},{-1,-2},{-2,-1},{1,-2},{2,-1}}){
+        if(are_valid_coords(col+cds.first, row+cds.second)){
+            result.direct[1] |= (uint64_t)1 << get_square(col+cds.first, row+cds.second);
+        }
+    }
+    for(std::pair<int,int> cds : (std::pair<int,int>[]) {{1,-1},{-1,1},{1,1},{-1,-1},{1,0},{-1,0},{0,1},{0,-1}}){
+        bool diagonal = cds.first != 0 && cds.second != 0;
+        // empty squares of the line up to the first piece (and the first piece, if it can be taken)
+        uint64_t line = 0;
+        int blocker = -1;
+        std::pair<int,int> curr = {col+cds.first, row+cds.second};
+        while(are_valid_coords(curr.first, curr.second)){
+            int sq = get_square(curr.first, curr.second);
+            curr.first += cds.first;
+            curr.second += cds.second;
+            if(m_board[sq] == '.'){
+                line |= (uint64_t)1 << sq;
+                continue;
+            }
+            if(is_upper(m_board[sq]) != white){
+                // opponent's piece
+                line |= (uint64_t)1 << sq;
+            } else {
+                blocker = sq;
+            }
+            break;
+        }
+        result.direct[diagonal ? 2 : 3] |= line;
+        result.direct[4] |= line;
+        if(blocker == -1){
+            continue;
+        }
+        // the own blocker gives discovered check if it moves away and an own sliding piece stands behind it
+        while(are_valid_coords(curr.first, curr.second)){
+            int sq = get_square(curr.first, curr.second);
+            curr.first += cds.first;
+            curr.second += cds.second;
+            if(m_board[sq] == '.'){
+                continue;
+            }
+            char piece = tolower(m_board[sq]);
+            if(is_upper(m_board[sq]) == white && (piece == 'q' || piece == (diagonal ? 'b' : 'r'))){
+                result.discoverers |= (uint64_t)1 << blocker;
+            }
+            break;
         }
     }
+    return result;
+}
+
+
+/**
+ * @brief returns true if the player to move has any legal move. Stops at the first legal move found, so it is cheaper
+ * than Position::get_possible_moves
+ */
+bool Position::has_legal_moves(){
+    return count_legal_moves(1) > 0;
+}
+
+
+/**
+ * @brief returns the number of legal moves of the player to move, but at most max_count. Stops when max_count moves are found
+ * (e.g. to tell a single legal reply from more replies without generating all of them)
+ */
+int Position::count_legal_moves(int max_count){
+    int legal = 0;
+    if(in_check()){
+        for(auto move : find_evasions()){
+            if(is_legal_pseudo_legal(move) && ++legal >= max_count){
+                break;
+            }
+        }
+        return legal;
+    }
+    // performing and un-doing a capture changes the order of m_pieces, the pieces are copied first
+    std::pair<char, int> own_pieces[32];
+    int count = 0;
+    for(auto piece : m_pieces){
+        if(is_upper(piece.first) == (m_to_move == 'w')){
+            own_pieces[count++] = piece;
+        }
+    }
+    for(int i = 0; i < count; i++){
+        for(auto move : find_pseudo_legal_moves(own_pieces[i].first, own_pieces[i].second)){
+            if(is_legal_pseudo_legal(move) && ++legal >= max_count){
+                return legal;
+            }
+        }
+    }
+    return legal;
+}
+
+
+/**
+ * @brief returns true if the move is legal in the current position. The move may come from anywhere
+ * (e.g. from the cache or from another position), only its squares and special information are compared
+ */
+bool Position::is_legal(Move move){
+    if(move.m_from < 0 || move.m_from >= 64 || move.m_to < 0 || move.m_to >= 64){
+        return false;
+    }
+    char piece = m_board[move.m_from];
+    if(piece == '.' || is_upper(piece) != (m_to_move == 'w')){
+        return false;
+    }
+    // only the moves of the moving piece are generated
+    for(auto pseudo_legal : find_pseudo_legal_moves(piece, move.m_from)){
+        if(pseudo_legal == move){
+            return is_legal_pseudo_legal(pseudo_legal);
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief returns the move given by its squares and promotion (see Move::pack) with the other fields filled from the current board.
+ * The move does not have to be legal, check it by Position::is_legal before performing it
+ */
+Move Position::unpack_move(uint16_t packed){
+    int from = packed & 63;
+    int to = (packed >> 6) & 63;
+    char piece = m_board[from];
+    char special = 0;
+    int promotion = (packed >> 12) & 7;
+    if(promotion > 0 && promotion < 5){
+        special = ".QRBN"[promotion];
+        special = is_upper(piece) ? special : tolower(special);
+    } else if(tolower(piece) == 'p' && to == m_en_passant){
+        special = is_upper(piece) ? 'E' : 'e';
+    }
+    return Move(from, to, piece, m_board[to], special, m_en_passant);
+}
+
+
+/**
+ * @brief returns true if the pseudo-legal move does not leave the king of the player to move in check
+ */
+bool Position::is_legal_pseudo_legal(Move move){
+    int own = m_to_move == 'w' ? 0 : 1; // index of player's king in m_kings to validate moves
+    bool check_squares_known = m_check_squares_known;
+    perform_move(move);
+    // look if player's king would be hit by opponent's piece
+    bool legal = m_kings[own] == -1 || !square_hit(m_kings[own], own == 1);
+    undo_move();
+    // the position is the same as before the move, its check squares are still valid
+    m_check_squares_known = check_squares_known;
+    return legal;
+}
+
+
+/**
+ * @brief Get iterator to given piece at given square in m_pieces
+ * 
+ * @return PieceList::iterator iterator to the piece or m_pieces.end() if not found
+ */
+PieceList::iterator Position::get_piece(char piece, int square){
+    auto ptr = m_pieces.at(square);
+    if(ptr != m_pieces.end() && ptr->first == piece){
+        return ptr;
+    }
     return m_pieces.end();
 }
 
 
 /**
- * @brief Performs the move and updates all necessary states (e.g. updating m_board, m_pieces, pushing the move to m_prev_moves etc.)
+ * @brief Performs the move and updates all necessary states (e.g. updating m_board, m_pieces, pushing the move to m_undo_stack etc.)
  * 
  * Does not check for move validity. Can be reverted by Position::undo_move() (only for valid moves, otherwise no guarantees)
+ * Never allocates memory.
  * 
  * @param move should be from Position::get_possible_moves()
  * 
- * @throws const char* in some cases of invalid moves to prevent SEGFAULT
+ * @throws const char* in some cases of invalid moves to prevent SEGFAULT or if MAX_GAME_PLY moves were already played
  */
 void Position::perform_move(Move move){
-    auto moved_piece = get_piece(move.m_piece, move.m_from);
-    if(moved_piece == m_pieces.end()){
+    if(get_piece(move.m_piece, move.m_from) == m_pieces.end()){
         throw "moving piece not found";
     }
+    m_undo_stack.push({move, m_hash, m_material, m_halfmove_clock, m_checkers});
+    m_checkers = UNKNOWN_CHECKERS;
+    m_check_squares_known = false;
     if(move.m_captured != '.'){
         // remove taken piece from the piece list
         auto taken_piece = get_piece(move.m_captured, move.m_to);
@@ -383,11 +1097,20 @@ void Position::perform_move(Move move){
             throw "taken piece not found";
         }
         m_pieces.erase(taken_piece);
+        m_hash ^= piece_key(move.m_captured, move.m_to);
+        m_material -= piece_value(move.m_captured);
     }
-    moved_piece->second = move.m_to;
+    // erasing the taken piece may have moved the moving piece inside m_pieces, find it again
+    auto moved_piece = m_pieces.at(move.m_from);
+    m_pieces.move(moved_piece, move.m_to);
     m_board[move.m_from] = '.';
     m_board[move.m_to] = move.m_piece;
-    m_prev_moves.push_back(move);
+    m_hash ^= piece_key(move.m_piece, move.m_from) ^ piece_key(move.m_piece, move.m_to);
+    if(move.m_piece == 'K'){
+        m_kings[0] = move.m_to;
+    } else if(move.m_piece == 'k'){
+        m_kings[1] = move.m_to;
+    }
     if(move.m_special){
         if(is_upper(move.m_piece) != is_upper(move.m_special)){
             throw("invalid special side");
@@ -401,6 +1124,8 @@ void Position::perform_move(Move move){
                 }
                 m_pieces.erase(taken);
                 m_board[move.m_to - 8] = '.';
+                m_hash ^= piece_key('P', move.m_to - 8);
+                m_material -= piece_value('P');
                 }
                 break;
             case 'E': // white en-passant
@@ -411,48 +1136,68 @@ void Position::perform_move(Move move){
                 }
                 m_pieces.erase(taken);
                 m_board[move.m_to + 8] = '.';
+                m_hash ^= piece_key('p', move.m_to + 8);
+                m_material -= piece_value('p');
                 }
                 break;
             default: // piece promotion
-                m_pieces.erase(moved_piece);
-                m_pieces.insert({move.m_special, move.m_to});
+                m_pieces.at(move.m_to)->first = move.m_special;
                 m_board[move.m_to] = move.m_special;
+                m_hash ^= piece_key(move.m_piece, move.m_to) ^ piece_key(move.m_special, move.m_to);
+                m_material += piece_value(move.m_special) - piece_value(move.m_piece);
         }
     }
+    // Update m_halfmove_clock
+    if(tolower(move.m_piece) == 'p' || move.m_captured != '.'){
+        m_halfmove_clock = 0;
+    } else {
+        m_halfmove_clock++;
+    }
     // Update m_en_passant
+    if(m_en_passant != -1){
+        m_hash ^= zobrist.en_passant[m_en_passant];
+    }
     if(tolower(move.m_piece) == 'p' && abs(move.m_from - move.m_to) == 16){
         m_en_passant = (move.m_to + move.m_from) / 2;
+        m_hash ^= zobrist.en_passant[m_en_passant];
     } else {
         m_en_passant = -1;
     }
-    // Swap m_to_move
+    // Swap m_to_move, the move number is increased after black's move
     if(m_to_move == 'w'){
         m_to_move = 'b';
     } else {
         m_to_move = 'w';
+        m_fullmove_number++;
     }
+    m_hash ^= zobrist.black_to_move;
 }
 
 
 /**
- * @brief Un-does the last move from m_prev_moves and updates all necessary states (e.g. updating m_board, m_pieces, pushing the move to m_prev_moves etc.)
+ * @brief Un-does the last move from m_undo_stack and updates all necessary states (e.g. updating m_board, m_pieces, popping the move from m_undo_stack etc.)
  * 
  * @throws const char* in some cases of invalid moves (corrupted states) to prevent SEGFAULT
  */
 void Position::undo_move(){
-    Move move = m_prev_moves.back();
-    m_prev_moves.pop_back();
+    StateDelta delta = m_undo_stack.pop();
+    Move move = delta.move;
     auto moved_piece = get_piece(m_board[move.m_to], move.m_to);
     if(moved_piece == m_pieces.end()){
         throw "moving piece not found";
     }
+    m_pieces.move(moved_piece, move.m_from);
     if(move.m_captured != '.'){
         // place back taken piece to the piece list
         m_pieces.insert({move.m_captured, move.m_to});
     }
-    moved_piece->second = move.m_from;
     m_board[move.m_from] = move.m_piece;
     m_board[move.m_to] = move.m_captured;
+    if(move.m_piece == 'K'){
+        m_kings[0] = move.m_from;
+    } else if(move.m_piece == 'k'){
+        m_kings[1] = move.m_from;
+    }
     if(move.m_special){
         if(is_upper(move.m_piece) != is_upper(move.m_special)){
             throw("invalid special side");
@@ -467,19 +1212,285 @@ void Position::undo_move(){
                 m_board[move.m_to + 8] = 'p';
                 break;
             default: // piece promotion
-                m_pieces.erase(moved_piece);
-                m_pieces.insert({move.m_piece, move.m_from});
-                m_board[move.m_from] = move.m_piece;
+                get_piece(move.m_special, move.m_from)->first = move.m_piece;
         }
     }
     // Swap m_to_move
     if(m_to_move == 'w'){
         m_to_move = 'b';
+        m_fullmove_number--;
     } else {
         m_to_move = 'w';
     }
-    // Update m_en_passant
+    // Update m_en_passant, hash, material and halfmove clock
     m_en_passant = move.m_last_enpassant;
+    m_hash = delta.hash;
+    m_material = delta.material;
+    m_halfmove_clock = delta.halfmove_clock;
+    m_checkers = delta.checkers;
+    m_check_squares_known = false;
+}
+
+
+/**
+ * @brief returns how many times the current position occurred earlier in the game (since the last capture or pawn move)
+ * 
+ * Compares hashes stored in m_undo_stack, only positions with the same player to move are checked.
+ */
+int Position::repetitions(){
+    int count = 0;
+    int last = m_undo_stack.size() - m_halfmove_clock; // positions before last irreversible move cannot repeat
+    for(int i = m_undo_stack.size() - 2; i >= 0 && i >= last; i -= 2){
+        if(m_undo_stack[i].hash == m_hash){
+            count++;
+        }
+    }
+    return count;
+}
+
+
+/**
+ * @brief returns true if the game is drawn by fifty-move rule or by threefold repetition
+ */
+bool Position::is_draw(){
+    return m_halfmove_clock >= 100 || repetitions() >= 2;
+}
+
+
+/**
+ * @brief returns bit mask (bit i for square i) of the opponent's pieces which check the king of the player to move.
+ * Computed once per position, the mask is kept in m_undo_stack, so it is not computed again after un-doing a move
+ */
+uint64_t Position::get_checkers(){
+    if(m_checkers != UNKNOWN_CHECKERS){
+        return m_checkers;
+    }
+    m_checkers = 0;
+    bool white = m_to_move == 'w';
+    int king = m_kings[white ? 0 : 1];
+    if(king != -1){
+        int attackers[16];
+        int count = find_attackers(king, !white, attackers, 16);
+        for(int i = 0; i < count; i++){
+            m_checkers |= (uint64_t)1 << attackers[i];
+        }
+    }
+    return m_checkers;
+}
+
+
+// returns true if the king of the player to move is in check (see Position::get_checkers)
+bool Position::in_check(){
+    return get_checkers() != 0;
+}
+
+
+/**
+ * @brief returns true if the pseudo-legal move of the player to move gives check (directly or by discovery).
+ * The move is not performed, it is decided by the check squares of the position (see Position::get_check_squares)
+ */
+bool Position::gives_check(Move move){
+    const CheckSquares& check_squares = get_check_squares();
+    if(check_squares.king == -1){
+        return false;
+    }
+    if(move.m_special != 0){
+        // promotions and en-passant may open lines through the vacated squares, the squares hit are checked on the changed board
+        char from = m_board[move.m_from];
+        char to = m_board[move.m_to];
+        int taken = move.is_promotion() ? -1 : move.m_to + (move.m_special == 'E' ? 8 : -8);
+        m_board[move.m_from] = '.';
+        m_board[move.m_to] = move.is_promotion() ? move.m_special : move.m_piece;
+        if(taken != -1){
+            m_board[taken] = '.';
+        }
+        bool check = square_hit(check_squares.king, m_to_move == 'w');
+        m_board[move.m_from] = from;
+        m_board[move.m_to] = to;
+        if(taken != -1){
+            m_board[taken] = move.m_special == 'E' ? 'p' : 'P';
+        }
+        return check;
+    }
+    uint64_t from = (uint64_t)1 << move.m_from;
+    uint64_t to = (uint64_t)1 << move.m_to;
+    if((check_squares.discoverers & from) != 0 && line_step(check_squares.king, move.m_to) != line_step(check_squares.king, move.m_from)){
+        // the piece moved away from the line of own sliding piece (it cannot pass the sliding piece, so the same direction means the same line)
+        return true;
+    }
+    const char* types = "pnbrq";
+    const char* type = strchr(types, tolower(move.m_piece));
+    return type != nullptr && *type != '\0' && (check_squares.direct[type - types] & to) != 0;
+}
+
+
+/**
+ * @brief finds pieces of given player which hit the square (see Position::square_hit)
+ * 
+ * @param attackers squares of the found pieces, at most max_count squares are stored
+ * 
+ * @return number of stored squares
+ */
+int Position::find_attackers(int square, bool by_white, int* attackers, int max_count){
+    int count = 0;
+    int col = square % 8;
+    int row = square / 8;
+    // returns true if the piece of the checked player of given type stands on the square
+    auto is_attacker = [&](int sq, std::initializer_list<char> types){
+        if(m_board[sq] == '.' || by_white != is_upper(m_board[sq])){
+            return false;
+        }
+        for(char type : types){
+            if(tolower(m_board[sq]) == type){
+                return true;
+            }
+        }
+        return false;
+    };
+    for(std::pair<int,int> cds : (std::pair<int,int>[]) {{1,2},{2,1},{-1,2},{-2,1},{-1,-2},{-2,-1},{1,-2},{2,-1}}){
+        // Knight hits
+        if(count < max_count && are_valid_coords(col+cds.first, row+cds.second) && is_attacker(get_square(col+cds.first, row+cds.second), {'n'})){
+            attackers[count++] = get_square(col+cds.first, row+cds.second);
+        }
+    }
+    for(int c_dir : {1, -1}){
+        // Pawn hits, white pawns hit from the row below the square
+        int pawn_row = row + (by_white ? 1 : -1);
+        if(count < max_count && are_valid_coords(col+c_dir, pawn_row) && is_attacker(get_square(col+c_dir, pawn_row), {'p'})){
+            attackers[count++] = get_square(col+c_dir, pawn_row);
+        }
+    }
+    for(std::pair<int,int> cds : (std::pair<int,int>[]) {{1,-1},{-1,1},{1,1},{-1,-1},{1,0},{-1,0},{0,1},{0,-1}}){
+        // King hits
+        if(count < max_count && are_valid_coords(col+cds.first, row+cds.second) && is_attacker(get_square(col+cds.first, row+cds.second), {'k'})){
+            attackers[count++] = get_square(col+cds.first, row+cds.second);
+        }
+        // sliding pieces, the first piece in the direction
+        bool diagonal = cds.first != 0 && cds.second != 0;
+        std::pair<int,int> curr = {col+cds.first, row+cds.second};
+        while(are_valid_coords(curr.first, curr.second)){
+            int sq = get_square(curr.first, curr.second);
+            if(m_board[sq] != '.'){
+                if(count < max_count && is_attacker(sq, {diagonal ? 'b' : 'r', 'q'})){
+                    attackers[count++] = sq;
+                }
+                break;
+            }
+            curr.first += cds.first;
+            curr.second += cds.second;
+        }
+    }
+    return count;
+}
+
+
+/**
+ * @brief generates pseudo-legal moves of the player to move, who is in check, which may resolve the check:
+ * king moves, captures of the checking piece and interpositions between a sliding checker and the king
+ * (only king moves in double check). The other pseudo-legal moves always leave the king in check
+ */
+std::vector<Move> Position::find_evasions(){
+    bool white = m_to_move == 'w';
+    int king = m_kings[white ? 0 : 1];
+    auto result = find_pseudo_legal_moves(white ? 'K' : 'k', king);
+    uint64_t checkers = get_checkers();
+    if((checkers & (checkers - 1)) != 0){
+        // double check, only the king can move
+        return result;
+    }
+    int checker = __builtin_ctzll(checkers);
+    find_moves_to(checker, &result);
+    char type = tolower(m_board[checker]);
+    if(type == 'b' || type == 'r' || type == 'q'){
+        // squares between the sliding checker and the king
+        int step = line_step(checker, king);
+        for(int sq = checker + step; sq != king; sq += step){
+            find_moves_to(sq, &result);
+        }
+    }
+    if(type == 'p' && m_en_passant != -1 && checker == m_en_passant + (white ? 8 : -8)){
+        // the checking pawn has just moved by two squares and can be taken en-passant
+        for(int c_dir : {1, -1}){
+            int col = checker % 8 + c_dir;
+            if(are_valid_coords(col, checker / 8) && m_board[get_square(col, checker / 8)] == (white ? 'P' : 'p')){
+                result.push_back(Move(get_square(col, checker / 8), m_en_passant, white ? 'P' : 'p', '.', white ? 'E' : 'e', m_en_passant));
+            }
+        }
+    }
+    return result;
+}
+
+
+/**
+ * @brief adds pseudo-legal moves of the pieces (except the king) of the player to move, which go to the target square
+ */
+void Position::find_moves_to(int target, std::vector<Move>* result){
+    bool white = m_to_move == 'w';
+    int col = target % 8;
+    int row = target / 8;
+    char captured = m_board[target];
+    // returns true if the piece of the player to move of one of given types stands on the square
+    auto is_own = [&](int sq, std::initializer_list<char> types){
+        if(m_board[sq] == '.' || white != is_upper(m_board[sq])){
+            return false;
+        }
+        for(char type : types){
+            if(tolower(m_board[sq]) == type){
+                return true;
+            }
+        }
+        return false;
+    };
+    for(std::pair<int,int> cds : (std::pair<int,int>[]) {{1,2},{2,1},{-1,2},{-2,1},{-1,-2},{-2,-1},{1,-2},{2,-1}}){
+        // knights
+        if(are_valid_coords(col+cds.first, row+cds.second) && is_own(get_square(col+cds.first, row+cds.second), {'n'})){
+            int sq = get_square(col+cds.first, row+cds.second);
+            result->push_back(Move(sq, target, m_board[sq], captured, 0, m_en_passant));
+        }
+    }
+    for(std::pair<int,int> cds : (std::pair<int,int>[]) {{1,-1},{-1,1},{1,1},{-1,-1},{1,0},{-1,0},{0,1},{0,-1}}){
+        // sliding pieces, the first piece in the direction
+        bool diagonal = cds.first != 0 && cds.second != 0;
+        std::pair<int,int> curr = {col+cds.first, row+cds.second};
+        while(are_valid_coords(curr.first, curr.second)){
+            int sq = get_square(curr.first, curr.second);
+            if(m_board[sq] != '.'){
+                if(is_own(sq, {diagonal ? 'b' : 'r', 'q'})){
+                    result->push_back(Move(sq, target, m_board[sq], captured, 0, m_en_passant));
+                }
+                break;
+            }
+            curr.first += cds.first;
+            curr.second += cds.second;
+        }
+    }
+    // pawns, white pawns move up (to lower rows)
+    char pawn = white ? 'P' : 'p';
+    int dir = white ? -1 : 1;
+    bool promotion = row == (white ? 0 : 7);
+    auto add_pawn_move = [&](int from){
+        if(promotion){
+            for(char p : {'Q', 'R', 'N', 'B'}){
+                result->push_back(Move(from, target, pawn, captured, white ? p : tolower(p), m_en_passant));
+            }
+        } else {
+            result->push_back(Move(from, target, pawn, captured, 0, m_en_passant));
+        }
+    };
+    if(captured == '.'){
+        if(are_valid_coords(col, row-dir) && m_board[get_square(col, row-dir)] == pawn){
+            add_pawn_move(get_square(col, row-dir));
+        } else if(row == (white ? 4 : 3) && m_board[get_square(col, row-dir)] == '.' && m_board[get_square(col, row-2*dir)] == pawn){
+            // move by two squares from the starting rank
+            add_pawn_move(get_square(col, row-2*dir));
+        }
+    } else if(is_upper(captured) != white){
+        for(int c_dir : {1, -1}){
+            if(are_valid_coords(col+c_dir, row-dir) && m_board[get_square(col+c_dir, row-dir)] == pawn){
+                add_pawn_move(get_square(col+c_dir, row-dir));
+            }
+        }
+    }
 }
 
 
@@ -487,12 +1498,16 @@ void Position::undo_move(){
  * @brief generates all pseudo-legal moves for the piece at given square. Pseudo-legal moves are moves that follow piece movement,
  * but may be illegal due to player exposing his king to opponent's pieces 
  * 
+ * @param filter only moves of this kind are generated (captures and promotions or the other moves), the others are not even built
+ * 
  * @return std::vector<Move> pseudo-legal moves
  */
-std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
+std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square, MoveFilter filter){
     auto result = std::vector<Move>();
     int col = square % 8;
     int row = square / 8;
+    bool captures = filter != MoveFilter::QUIETS;
+    bool quiets = filter != MoveFilter::CAPTURES;
 
     switch(tolower(piece)){ // switch based on piece type (not by color)
         case 'p': // pawn
@@ -505,7 +1520,7 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
             }
             for(int c_dir : {1, -1}){
                 // diagonal movement - taking opponent's piece
-                if(!are_valid_coords(col+c_dir, row+dir)){
+                if(!captures || !are_valid_coords(col+c_dir, row+dir)){
                     continue;
                 }
                 int sq = get_square(col+c_dir, row+dir);
@@ -530,9 +1545,9 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
                     result.push_back(Move(square, sq, piece, m_board[sq], is_upper(piece) ? 'E' : 'e', m_en_passant));
                 }
             }
-            if((m_board[get_square(col, row+dir)] == '.')){
+            if((m_board[get_square(col, row+dir)] == '.') && ((row+dir == 0 || row+dir == 7) ? captures : quiets)){
                 // since unpromoted pawn cannot exist on first/last rank, the square is always valid
-                // moving pawn one square forward
+                // moving pawn one square forward (promotions are generated with captures)
                 int sq = get_square(col, row+dir);
                 if(row+dir == 0){
                     // white promotion
@@ -549,6 +1564,7 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
                 }
             }
             if(
+                quiets &&
                 ((is_upper(piece) && row == 6) || (!is_upper(piece) && row == 1)) && // is on 2rd rank if white or 7th rank if black
                 m_board[get_square(col,row+dir)] == '.' && m_board[get_square(col, row+2*dir)] == '.' // both the squares in front of the pawn are empty
             ){
@@ -562,7 +1578,7 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
                     continue;
                 }
                 int sq = get_square(col+cds.first, row+cds.second);
-                if(m_board[sq] == '.' || is_upper(piece) != is_upper(m_board[sq])){
+                if(m_board[sq] == '.' ? quiets : (captures && is_upper(piece) != is_upper(m_board[sq]))){
                     // the square is empty or contains opponent's piece
                     result.push_back(Move(square, get_square(col+cds.first, row+cds.second), piece, m_board[sq], 0, m_en_passant));
                 }
@@ -574,7 +1590,7 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
                     continue;
                 }
                 int sq = get_square(col+cds.first, row+cds.second);
-                if(m_board[sq] == '.' || is_upper(piece) != is_upper(m_board[sq])){
+                if(m_board[sq] == '.' ? quiets : (captures && is_upper(piece) != is_upper(m_board[sq]))){
                     // the square is empty or contains opponent's piece
                     result.push_back(Move(square, get_square(col+cds.first, row+cds.second), piece, m_board[sq], 0, m_en_passant));
                 }
@@ -590,7 +1606,9 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
                         break;
                     }
                     // if the square is empty or contain opponent's piece, the move is possible
-                    result.push_back(Move(square, get_square(curr.first, curr.second), piece, m_board[sq], 0, m_en_passant));
+                    if(m_board[sq] == '.' ? quiets : captures){
+                        result.push_back(Move(square, get_square(curr.first, curr.second), piece, m_board[sq], 0, m_en_passant));
+                    }
                     if(m_board[sq] != '.'){
                         // any piece, we cannot move any further 
                         break;
@@ -610,7 +1628,9 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
                         break;
                     }
                     // if the square is empty or contain opponent's piece, the move is possible
-                    result.push_back(Move(square, get_square(curr.first, curr.second), piece, m_board[sq], 0, m_en_passant));
+                    if(m_board[sq] == '.' ? quiets : captures){
+                        result.push_back(Move(square, get_square(curr.first, curr.second), piece, m_board[sq], 0, m_en_passant));
+                    }
                     if(m_board[sq] != '.'){
                         // any piece, we cannot move any further 
                         break;
@@ -630,7 +1650,9 @@ std::vector<Move> Position::find_pseudo_legal_moves(char piece, int square){
                         break;
                     }
                     // if the square is empty or contain opponent's piece, the move is possible
-                    result.push_back(Move(square, get_square(curr.first, curr.second), piece, m_board[sq], 0, m_en_passant));
+                    if(m_board[sq] == '.' ? quiets : captures){
+                        result.push_back(Move(square, get_square(curr.first, curr.second), piece, m_board[sq], 0, m_en_passant));
+                    }
                     if(m_board[sq] != '.'){
                         // any piece, we cannot move any further 
                         break;
@@ -2,8 +2,9 @@
 
 #include "move.h"
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_map>
+#include <cstdint>
 
 /**
  * @brief uses isupper from C/C++ standard library, but returns bool instead of int.
@@ -31,6 +32,187 @@ int get_square(int col, int row);
  */
 int get_square(std::string str);
 
+/**
+ * @brief returns material value of the piece (positive for white pieces, negative for black pieces, 0 for empty square '.')
+ * 
+ */
+int piece_value(char piece);
+
+// Maximal number of half-moves which can be played (and un-done) on a single Position instance
+const int MAX_GAME_PLY = 1024;
+
+/**
+ * @brief Fixed-capacity lookup piece -> square. Contains (piece, square) pairs, iteration order is unspecified.
+ * 
+ * Unlike std::unordered_multimap it never allocates, so performing and un-doing moves is allocation free.
+ * Erasing a piece moves the last piece of the list into its slot, thus erase() invalidates iterators to the last piece.
+ */
+class PieceList{
+
+    public:
+        typedef std::pair<char, int>* iterator;
+
+        PieceList();
+
+        iterator begin();
+        iterator end();
+        size_t size();
+
+        // returns iterator to any piece of given type or end() if there is no such piece
+        iterator find(char piece);
+
+        // returns iterator to the piece standing on given square or end() if the square is empty
+        iterator at(int square);
+
+        /**
+         * @brief adds the piece to the list
+         * 
+         * @throws const char* if there are more than 32 pieces
+         */
+        void insert(std::pair<char, int> piece);
+
+        // removes all pieces
+        void clear();
+
+        // removes the piece from the list
+        void erase(iterator piece);
+
+        // changes the square of the piece
+        void move(iterator piece, int square);
+
+    private:
+        std::pair<char, int> m_items[32];
+
+        // index of the piece in m_items for every square or -1 if the square is empty
+        signed char m_index[64];
+
+        int m_size;
+};
+
+/**
+ * @brief Information needed to un-do a move (captured piece and previous en-passant are stored in the move itself)
+ * 
+ */
+struct StateDelta{
+
+    // played move
+    Move move;
+
+    // hash of the position before the move
+    uint64_t hash;
+
+    // material of the position before the move
+    int material;
+
+    // halfmove clock of the position before the move
+    int halfmove_clock;
+
+    // cached checkers of the position before the move (see Position::get_checkers), ~0 if they were not computed
+    uint64_t checkers;
+};
+
+/**
+ * @brief Fixed-capacity stack of StateDelta. Copying the stack copies only the occupied part.
+ * 
+ */
+class UndoStack{
+
+    public:
+        UndoStack();
+        UndoStack(const UndoStack& other);
+        UndoStack& operator=(const UndoStack& other);
+
+        /**
+         * @throws const char* if more than MAX_GAME_PLY moves were played
+         */
+        void push(const StateDelta& delta);
+
+        // removes and returns last delta (the stack must not be empty)
+        StateDelta pop();
+
+        // last delta (the stack must not be empty)
+        StateDelta& back();
+
+        // i-th delta from the bottom of the stack
+        StateDelta& operator[](int i);
+
+        int size();
+
+        void clear();
+
+    private:
+        StateDelta m_items[MAX_GAME_PLY];
+        int m_size;
+};
+
+/**
+ * @brief Reasons why parse_fen() rejected a FEN
+ * 
+ */
+enum class FenError{
+    OK,
+    BAD_BOARD,
+    BAD_SIDE_TO_MOVE,
+    BAD_CASTLING,
+    BAD_EN_PASSANT,
+    BAD_COUNTERS,
+    KING_COUNT,
+    TOO_MANY_PIECES,
+    PAWN_ON_BACK_RANK,
+    OPPONENT_IN_CHECK
+};
+
+/**
+ * @brief returns human readable description of the FEN parsing error
+ */
+const char* fen_error_string(FenError error);
+
+/**
+ * @brief Kinds of moves generated by Position::get_possible_moves
+ * 
+ */
+enum class MoveFilter{
+    ALL,
+
+    // captures (including en-passant) and promotions
+    CAPTURES,
+
+    // all the other moves
+    QUIETS
+};
+
+/**
+ * @brief Squares from which the pieces of the player to move would check the opponent's king (see Position::get_check_squares).
+ * Squares are stored as bit masks (bit i for square i)
+ * 
+ */
+struct CheckSquares{
+
+    // square of the opponent's king or -1 if it is not on board
+    int king;
+
+    // squares giving direct check for pawn, knight, bishop, rook and queen (index in "pnbrq")
+    uint64_t direct[5];
+
+    // own pieces which block a line of own sliding piece to the king (moving them away from the line gives discovered check)
+    uint64_t discoverers;
+};
+
+class Position;
+
+/**
+ * @brief Parses FEN (see https://en.wikipedia.org/wiki/Forsyth%E2%80%93Edwards_Notation) into given position. Never throws.
+ * 
+ * Validates board shape, piece letters, king counts, pawns on back ranks, side to move, castling field (which is ignored),
+ * en-passant consistency and that the side not to move is not in check. Halfmove clock and fullmove number are optional.
+ * Trailing whitespace is allowed, anything else after the FEN is an error.
+ * 
+ * The parsing does not allocate memory, reusing one Position for many FENs is the fastest way to screen large files.
+ * 
+ * @return FenError::OK on success, otherwise the error (the position is left in unspecified, but valid for another parse_fen, state)
+ */
+FenError parse_fen(std::string_view fen, Position* position);
+
 /**
  * @brief Represents a board state.
  * Does not support castles.
@@ -39,7 +221,7 @@ class Position{
 
     public:
         /*
-        Stores board information for lookup square -> piece. Is terminated by 'null character' as it is used as std::string for hashing
+        Stores board information for lookup square -> piece. Is terminated by 'null character' so that it can be used as std::string
 
         index:
         00 01 02 03 04 05 06 07
@@ -79,32 +261,88 @@ class Position{
         // square available for en-passant or -1 if such square does not exist
         int m_en_passant;
 
-        // stores board information for lookup piece -> square. equal_range(char piece) contains all the squares which contain given piece
-        std::unordered_multimap<char, int> m_pieces;
+        // stores board information for lookup piece -> square
+        PieceList m_pieces;
+
+        // stores state deltas of all moves played on the board. Last played move is m_undo_stack.back().move. Is used to un-do moves correctly.
+        UndoStack m_undo_stack;
 
-        // stores all previous moves, that were played on the board. Last played move is m_prev_moves.back(). Is used to un-do moves correctly.
-        std::vector<Move> m_prev_moves;
+        // incrementally updated hash of the position (see Position::get_hash())
+        uint64_t m_hash;
+
+        // incrementally updated material difference (sum of piece_value() of all pieces on board)
+        int m_material;
+
+        // squares of white and black king (index 0 for white) or -1 if the king is not on board
+        int m_kings[2];
+
+        // number of half-moves since last capture or pawn move (used for fifty-move rule)
+        int m_halfmove_clock;
+
+        // number of the full move, starts at 1 and is increased after black's move
+        int m_fullmove_number;
 
         // returns printable string representing the current board state
         std::string to_string();
 
 
         /**
-         * @brief eturns 64-bit hash representing the board state (the hash changes if a move is played on the board).
+         * @brief returns 64-bit hash representing the board state (the hash changes if a move is played on the board).
          * A position instance thus cannot be used as a key in std::unordered_map. The hash is used in evaluation in lookup table.
          * 
+         * The hash is Zobrist hash updated incrementally in perform_move() and restored in undo_move().
          * Hash collisions may appear, but i think it should be too rare to handle.
          */
         size_t get_hash();
 
 
+        /**
+         * @brief returns hash (see Position::get_hash()) of the position transformed by a symmetry of the board. Without castles
+         * the transformed position has the same content as the original one.
+         * 
+         * @param flip_colors the board is mirrored vertically (rank 1 <-> rank 8), pieces change colors and the other player is to move
+         * @param mirror_files the board is mirrored horizontally (file a <-> file h)
+         */
+        size_t get_symmetric_hash(bool flip_colors, bool mirror_files);
+
+
+        /**
+         * @brief returns the last played move (at least one move has to be played on the board)
+         */
+        Move last_move();
+
+
+        // returns number of half-moves played on the board (and which can be un-done)
+        int ply();
+
+
+        // returns number of half-moves played in the whole game (derived from the fullmove number, so it includes moves before the FEN)
+        int game_ply();
+
+
+        /**
+         * @brief returns how many times the current position occurred earlier in the game (since the last capture or pawn move)
+         * 
+         * Compares hashes stored in m_undo_stack, only positions with the same player to move are checked.
+         */
+        int repetitions();
+
+
+        /**
+         * @brief returns true if the game is drawn by fifty-move rule or by threefold repetition
+         */
+        bool is_draw();
+
+
         /**
          * @brief Returns new Position represented by given FEN string (see https://en.wikipedia.org/wiki/Forsyth%E2%80%93Edwards_Notation)
          * FEN notation is commonly used across chess software making it possible to easily import the position to other program
          * 
-         * @throws std::exception May throw stdlib C/C++ exceptions / SEGFAULT if the FEN is invalid
+         * Halfmove clock and fullmove number are optional (default to 0 and 1). The parsing does not allocate memory.
+         * 
+         * @throws const char* if the FEN is invalid (see parse_fen() for non-throwing alternative)
          */
-        Position(std::string FEN);
+        Position(std::string_view FEN);
 
 
         /**
@@ -140,33 +378,105 @@ class Position{
         /**
          * @brief finds all legal moves in the current position for the player to move
          * 
+         * @param filter only moves of this kind are generated (e.g. captures first and quiet moves later, see Engine::MovePicker)
+         * 
          * @return std::vector<Move> possible moves
          */
-        std::vector<Move> get_possible_moves();
+        std::vector<Move> get_possible_moves(MoveFilter filter=MoveFilter::ALL);
+
+
+        /**
+         * @brief finds all legal moves by performing every pseudo-legal move of every piece of the player to move and testing
+         * the king by square_hit. Slow reference for the generators of the position (see SelfCheck::run), not used by the engine
+         */
+        std::vector<Move> get_possible_moves_by_trying();
+
+
+        /**
+         * @brief finds all legal moves of the player to move which give check (directly or by discovery).
+         * 
+         * Only the moves which give check are performed (to test their legality), the others are rejected by
+         * the check squares of the position (see Position::get_check_squares)
+         */
+        std::vector<Move> get_checking_moves();
+
+
+        /**
+         * @brief returns the squares from which the pieces of the player to move would give check and the pieces
+         * which would give discovered check by moving away. Computed once per position (until a move is performed or un-done)
+         */
+        const CheckSquares& get_check_squares();
+
+
+        /**
+         * @brief returns bit mask (bit i for square i) of the opponent's pieces which check the king of the player to move.
+         * Computed once per position, the mask is kept in m_undo_stack, so it is not computed again after un-doing a move
+         */
+        uint64_t get_checkers();
+
+
+        // returns true if the king of the player to move is in check (see Position::get_checkers)
+        bool in_check();
+
+
+        /**
+         * @brief returns true if the pseudo-legal move of the player to move gives check (directly or by discovery).
+         * The move is not performed, it is decided by the check squares of the position (see Position::get_check_squares)
+         */
+        bool gives_check(Move move);
+
+
+        /**
+         * @brief returns true if the player to move has any legal move. Stops at the first legal move found, so it is cheaper
+         * than Position::get_possible_moves
+         */
+        bool has_legal_moves();
+
+
+        /**
+         * @brief returns the number of legal moves of the player to move, but at most max_count. Stops when max_count moves are found
+         * (e.g. to tell a single legal reply from more replies without generating all of them)
+         */
+        int count_legal_moves(int max_count);
+
+
+        /**
+         * @brief returns true if the move is legal in the current position. The move may come from anywhere
+         * (e.g. from the cache or from another position), only its squares and special information are compared
+         */
+        bool is_legal(Move move);
+
+
+        /**
+         * @brief returns the move given by its squares and promotion (see Move::pack) with the other fields filled from the current board.
+         * The move does not have to be legal, check it by Position::is_legal before performing it
+         */
+        Move unpack_move(uint16_t packed);
 
 
         /**
          * @brief Get iterator to given piece at given square in m_pieces
          * 
-         * @return std::unordered_multimap<char, int>::iterator iterator to the piece or m_pieces.end() if not found
+         * @return PieceList::iterator iterator to the piece or m_pieces.end() if not found
          */
-        std::unordered_multimap<char, int>::iterator get_piece(char piece, int square);
+        PieceList::iterator get_piece(char piece, int square);
 
 
         /**
-         * @brief Performs the move and updates all necessary states (e.g. updating m_board, m_pieces, pushing the move to m_prev_moves etc.)
+         * @brief Performs the move and updates all necessary states (e.g. updating m_board, m_pieces, pushing the move to m_undo_stack etc.)
          * 
          * Does not check for move validity. Can be reverted by Position::undo_move() (only for valid moves, otherwise no guarantees)
+         * Never allocates memory.
          * 
          * @param move should be from Position::get_possible_moves()
          * 
-         * @throws const char* in some cases of invalid moves to prevent SEGFAULT
+         * @throws const char* in some cases of invalid moves to prevent SEGFAULT or if MAX_GAME_PLY moves were already played
          */
         void perform_move(Move move);
 
 
         /**
-         * @brief Un-does the last move from m_prev_moves and updates all necessary states (e.g. updating m_board, m_pieces, pushing the move to m_prev_moves etc.)
+         * @brief Un-does the last move from m_undo_stack and updates all necessary states (e.g. updating m_board, m_pieces, popping the move from m_undo_stack etc.)
          * 
          * @throws const char* in some cases of invalid moves (corrupted states) to prevent SEGFAULT
          */
@@ -175,12 +485,54 @@ class Position{
 
     private:
 
+        friend FenError parse_fen(std::string_view fen, Position* position);
+
+        // cached result of Position::get_checkers, ~0 if it was not computed yet
+        uint64_t m_checkers;
+
+        // cached result of Position::get_check_squares, valid if m_check_squares_known is true
+        CheckSquares m_check_squares;
+        bool m_check_squares_known;
+
+        /**
+         * @brief computes m_hash, m_material and m_kings from m_board and clears the cached checkers. Used by constructors
+         */
+        void init_state();
+
+        /**
+         * @brief returns true if the pseudo-legal move does not leave the king of the player to move in check
+         */
+        bool is_legal_pseudo_legal(Move move);
+
+        /**
+         * @brief finds pieces of given player which hit the square (see Position::square_hit)
+         * 
+         * @param attackers squares of the found pieces, at most max_count squares are stored
+         * 
+         * @return number of stored squares
+         */
+        int find_attackers(int square, bool by_white, int* attackers, int max_count);
+
+        /**
+         * @brief generates pseudo-legal moves of the player to move, who is in check, which may resolve the check:
+         * king moves, captures of the checking piece and interpositions between a sliding checker and the king
+         * (only king moves in double check). The other pseudo-legal moves always leave the king in check
+         */
+        std::vector<Move> find_evasions();
+
+        /**
+         * @brief adds pseudo-legal moves of the pieces (except the king) of the player to move, which go to the target square
+         */
+        void find_moves_to(int target, std::vector<Move>* result);
+
         /**
          * @brief generates all pseudo-legal moves for the piece at given square. Pseudo-legal moves are moves that follow piece movement,
          * but may be illegal due to player exposing his king to opponent's pieces 
          * 
+         * @param filter only moves of this kind are generated (captures and promotions or the other moves), the others are not even built
+         * 
          * @return std::vector<Move> pseudo-legal moves
          */
-        std::vector<Move> find_pseudo_legal_moves(char piece, int square);
+        std::vector<Move> find_pseudo_legal_moves(char piece, int square, MoveFilter filter=MoveFilter::ALL);
 
 };
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "position.h"
+#include "puzzle_db.h"
+
+namespace PuzzleDB{
+
+    // pieces are stored as their index in this string
+    const char PIECE_CODES[] = ".PNBRQKpnbrqk";
+
+    // order of pieces in material signature
+    const std::string MATERIAL_ORDER = "QRBNPqrbnp";
+
+    // promotion pieces stored in bits 12-14 of a move (0 if the move is not a promotion)
+    const std::string PROMOTION_CODES = ".QRBN";
+
+    /**
+     * @brief Header of the database file, all offsets are in bytes from the start of the file
+     *
+     */
+    struct Header{
+        char magic[8];
+        uint64_t count;
+        uint64_t moves_offset;
+        uint64_t moves_count;
+        uint64_t seeds_offset;
+        uint64_t seeds_size;
+
+        // index entries followed by the sorted record numbers (uint32_t)
+        uint64_t index_offset;
+        uint64_t groups;
+    };
+
+    const char FILE_MAGIC[8] = {'T', 'A', 'C', 'T', 'P', 'D', 'B', '1'};
+
+    static_assert(sizeof(Header) == 64, "unexpected header layout");
+    static_assert(sizeof(PuzzleRecord) == 72, "unexpected record layout");
+    static_assert(sizeof(IndexEntry) == 32, "unexpected index layout");
+
+    /**
+     * @brief returns material signature of the position. The signature stores counts of pieces (except kings) of both sides
+     * in 4 bits per piece type (white Q, R, B, N, P, then black)
+     */
+    uint64_t material_signature(Position* position){
+        uint64_t signature = 0;
+        for(auto& piece : position->m_pieces){
+            size_t i = MATERIAL_ORDER.find(piece.first);
+            if(i != std::string::npos){
+                signature += (uint64_t)1 << (4 * i);
+            }
+        }
+        return signature;
+    }
+
+    /**
+     * @brief converts text signature (e.g. "KRPvKQ", the same notation as tablebases use) to material signature
+     *
+     * @throws const char* if the signature is invalid
+     */
+    uint64_t parse_material_signature(const std::string& signature){
+        size_t separator = signature.find('v');
+        if(separator == std::string::npos || signature.find('v', separator + 1) != std::string::npos){
+            throw "invalid material signature";
+        }
+        uint64_t result = 0;
+        for(size_t i = 0; i < signature.length(); i++){
+            if(i == separator || toupper(signature[i]) == 'K'){
+                continue;
+            }
+            size_t code = MATERIAL_ORDER.find(toupper(signature[i]));
+            if(code == std::string::npos){
+                throw "invalid material signature";
+            }
+            code += i > separator ? 5 : 0;
+            if(((result >> (4 * code)) & 15) == 15){
+                throw "invalid material signature";
+            }
+            result += (uint64_t)1 << (4 * code);
+        }
+        return result;
+    }
+
+    /**
+     * @throws const char* if the file cannot be created
+     */
+    Writer::Writer(const std::string& path){
+        m_file.open(path, std::ios::binary | std::ios::trunc);
+        if(!m_file){
+            throw "cannot create puzzle database";
+        }
+        // the header is written by finish()
+        Header header = {};
+        m_file.write((const char*)&header, sizeof(header));
+    }
+
+    /**
+     * @brief adds the puzzle
+     *
+     * @param solution moves of the solution (at most 65535)
+     * @param generation_time time spent generating the puzzle in milliseconds
+     */
+    void Writer::add(Position* puzzle, int mate_moves, const std::vector<Move>& solution, const std::string& seed, uint32_t generation_time){
+        PuzzleRecord record = {};
+        record.material = material_signature(puzzle);
+        record.moves_offset = m_moves.size();
+        record.seed_offset = m_seeds.size();
+        record.generation_time = generation_time;
+        record.fullmove_number = puzzle->m_fullmove_number;
+        record.solution_length = solution.size();
+        for(int square = 0; square < 64; square++){
+            int code = strchr(PIECE_CODES, puzzle->m_board[square]) - PIECE_CODES;
+            record.board[square / 2] |= code << (4 * (square % 2));
+        }
+        record.to_move = puzzle->m_to_move == 'w' ? 0 : 1;
+        record.en_passant = puzzle->m_en_passant;
+        record.halfmove_clock = std::min(puzzle->m_halfmove_clock, 255);
+        record.mate_moves = mate_moves;
+
+        for(auto m : solution){
+            m_moves.push_back(m.pack());
+        }
+        m_seeds.insert(m_seeds.end(), seed.begin(), seed.end());
+        m_seeds.push_back('\0');
+        m_keys.push_back({mate_moves, record.material});
+        m_file.write((const char*)&record, sizeof(record));
+    }
+
+    /**
+     * @brief writes the remaining sections and the header. No puzzles can be added after that
+     *
+     * @throws const char* if the file cannot be written
+     */
+    void Writer::finish(){
+        Header header = {};
+        memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+        header.count = m_keys.size();
+        header.moves_offset = sizeof(Header) + header.count * sizeof(PuzzleRecord);
+        header.moves_count = m_moves.size();
+        header.seeds_offset = header.moves_offset + m_moves.size() * sizeof(uint16_t);
+        header.seeds_size = m_seeds.size();
+        m_file.write((const char*)m_moves.data(), m_moves.size() * sizeof(uint16_t));
+        m_file.write(m_seeds.data(), m_seeds.size());
+
+        // the index is aligned to 8 bytes, so that it can be accessed in place
+        uint64_t end = header.seeds_offset + header.seeds_size;
+        header.index_offset = (end + 7) / 8 * 8;
+        char padding[8] = {};
+        m_file.write(padding, header.index_offset - end);
+
+        // record numbers sorted by (mate moves, material), stable so that the records of a group keep their order
+        auto sorted = std::vector<uint32_t>(m_keys.size());
+        for(size_t i = 0; i < sorted.size(); i++){
+            sorted[i] = i;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b){ return m_keys[a] < m_keys[b]; });
+        auto index = std::vector<IndexEntry>();
+        for(size_t i = 0; i < sorted.size(); i++){
+            if(i == 0 || m_keys[sorted[i]] != m_keys[sorted[i - 1]]){
+                index.push_back({m_keys[sorted[i]].second, m_keys[sorted[i]].first, 0, i, 0});
+            }
+            index.back().count++;
+        }
+        header.groups = index.size();
+        m_file.write((const char*)index.data(), index.size() * sizeof(IndexEntry));
+        m_file.write((const char*)sorted.data(), sorted.size() * sizeof(uint32_t));
+
+        m_file.seekp(0);
+        m_file.write((const char*)&header, sizeof(header));
+        m_file.close();
+        if(!m_file){
+            throw "cannot write puzzle database";
+        }
+    }
+
+    // returns number of added puzzles
+    uint64_t Writer::size(){
+        return m_keys.size();
+    }
+
+    /**
+     * @throws const char* if the file cannot be opened or is not a puzzle database
+     */
+    Database::Database(const std::string& path){
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0){
+            throw "cannot open puzzle database";
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(Header)){
+            close(fd);
+            throw "invalid puzzle database";
+        }
+        m_length = info.st_size;
+        void* mapping = mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED){
+            throw "cannot map puzzle database";
+        }
+        m_data = (const uint8_t*)mapping;
+        const Header* header = (const Header*)m_data;
+        if(memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0
+            || header->index_offset + header->groups * sizeof(IndexEntry) + header->count * sizeof(uint32_t) != m_length){
+            munmap(mapping, m_length);
+            throw "invalid puzzle database";
+        }
+        m_size = header->count;
+        m_groups = header->groups;
+        m_records = (const PuzzleRecord*)(m_data + sizeof(Header));
+        m_moves = (const uint16_t*)(m_data + header->moves_offset);
+        m_seeds = (const char*)(m_data + header->seeds_offset);
+        m_index = (const IndexEntry*)(m_data + header->index_offset);
+        m_sorted = (const uint32_t*)(m_index + m_groups);
+    }
+
+    Database::~Database(){
+        munmap((void*)m_data, m_length);
+    }
+
+    // returns number of puzzles
+    uint64_t Database::size(){
+        return m_size;
+    }
+
+    // returns i-th record (in place, no copying)
+    const PuzzleRecord& Database::record(uint64_t i){
+        return m_records[i];
+    }
+
+    // returns the position of the i-th puzzle
+    Position Database::get_position(uint64_t i){
+        const PuzzleRecord& r = m_records[i];
+        std::string fen;
+        for(int row = 0; row < 8; row++){
+            int empty = 0;
+            for(int col = 0; col < 8; col++){
+                int square = row * 8 + col;
+                char piece = PIECE_CODES[(r.board[square / 2] >> (4 * (square % 2))) & 15];
+                if(piece == '.'){
+                    empty++;
+                    continue;
+                }
+                if(empty > 0){
+                    fen += (char)('0' + empty);
+                    empty = 0;
+                }
+                fen += piece;
+            }
+            if(empty > 0){
+                fen += (char)('0' + empty);
+            }
+            if(row < 7){
+                fen += '/';
+            }
+        }
+        fen += r.to_move == 0 ? " w - " : " b - ";
+        fen += r.en_passant >= 0 ? square_string(r.en_passant) : "-";
+        fen += " " + std::to_string(r.halfmove_clock) + " " + std::to_string(r.fullmove_number);
+        return Position(fen);
+    }
+
+    // returns solution moves of the i-th puzzle (as moves of the position, so they can be performed)
+    std::vector<Move> Database::get_solution(uint64_t i){
+        const PuzzleRecord& r = m_records[i];
+        Position position = get_position(i);
+        auto solution = std::vector<Move>();
+        for(int j = 0; j < r.solution_length; j++){
+            uint16_t packed = m_moves[r.moves_offset + j];
+            char promotion = PROMOTION_CODES[packed >> 12];
+            for(auto m : position.get_possible_moves()){
+                bool is_promotion = m.m_special != 0 && tolower(m.m_special) != 'e';
+                if(m.m_from == (packed & 63) && m.m_to == ((packed >> 6) & 63) && (is_promotion ? toupper(m.m_special) : '.') == promotion){
+                    solution.push_back(m);
+                    position.perform_move(m);
+                    break;
+                }
+            }
+            if((int)solution.size() != j + 1){
+                throw "invalid solution move in puzzle database";
+            }
+        }
+        return solution;
+    }
+
+    // returns seed of the i-th puzzle
+    const char* Database::seed(uint64_t i){
+        return m_seeds + m_records[i].seed_offset;
+    }
+
+    // returns all groups of the index (sorted by mate length and material)
+    std::vector<IndexEntry> Database::groups(){
+        return std::vector<IndexEntry>(m_index, m_index + m_groups);
+    }
+
+    /**
+     * @brief returns numbers of records with given mate length (and material, if it is not 0) as a range [begin, end)
+     * of the sorted list of record numbers, which is stored in the file
+     */
+    std::pair<const uint32_t*, const uint32_t*> Database::find(int mate_moves, uint64_t material){
+        // groups are sorted by (mate moves, material), so the groups of one mate length are next to each other
+        auto less = [](const IndexEntry& entry, std::pair<uint32_t, uint64_t> key){
+            return std::make_pair(entry.mate_moves, entry.material) < key;
+        };
+        const IndexEntry* first = std::lower_bound(m_index, m_index + m_groups, std::make_pair((uint32_t)mate_moves, material), less);
+        const IndexEntry* last = first;
+        if(material != 0){
+            if(last != m_index + m_groups && last->mate_moves == (uint32_t)mate_moves && last->material == material){
+                last++;
+            }
+        } else {
+            while(last != m_index + m_groups && last->mate_moves == (uint32_t)mate_moves){
+                last++;
+            }
+        }
+        if(first == last){
+            return {m_sorted, m_sorted};
+        }
+        return {m_sorted + first->first, m_sorted + (last - 1)->first + (last - 1)->count};
+    }
+
+}
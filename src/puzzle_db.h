@@ -0,0 +1,179 @@
+#pragma once
+
+#include "position.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+/**
+ * @brief Binary database of puzzles.
+ *
+ * The file consists of a header, fixed-size puzzle records, solution moves (2 bytes per move), seeds (null-terminated strings)
+ * and an index of the records by mate length and material signature. The file is memory-mapped when opened,
+ * records are accessed in place without any parsing.
+ */
+namespace PuzzleDB{
+
+    /**
+     * @brief Puzzle stored in the database, the layout is fixed (72 bytes)
+     *
+     */
+    struct PuzzleRecord{
+
+        // material of the puzzle (see PuzzleDB::material_signature)
+        uint64_t material;
+
+        // index of the first solution move in the moves section
+        uint64_t moves_offset;
+
+        // offset of the seed in the seeds section
+        uint64_t seed_offset;
+
+        // time spent generating the puzzle in milliseconds
+        uint32_t generation_time;
+
+        uint16_t fullmove_number;
+
+        // number of half-moves of the solution (stored in the moves section)
+        uint16_t solution_length;
+
+        // two squares per byte (low 4 bits for the even square), pieces are coded by their index in ".PNBRQKpnbrqk"
+        uint8_t board[32];
+
+        // 0 for white, 1 for black
+        uint8_t to_move;
+
+        // en-passant square or -1
+        int8_t en_passant;
+
+        uint8_t halfmove_clock;
+
+        // number of moves to mate
+        uint8_t mate_moves;
+
+        uint8_t reserved[4];
+    };
+
+    /**
+     * @brief Group of records with the same mate length and material in the index
+     *
+     */
+    struct IndexEntry{
+        uint64_t material;
+        uint32_t mate_moves;
+        uint32_t reserved;
+
+        // position of the first record of the group in the sorted list of record numbers
+        uint64_t first;
+        uint64_t count;
+    };
+
+    /**
+     * @brief returns material signature of the position. The signature stores counts of pieces (except kings) of both sides
+     * in 4 bits per piece type (white Q, R, B, N, P, then black)
+     */
+    uint64_t material_signature(Position* position);
+
+    /**
+     * @brief converts text signature (e.g. "KRPvKQ", the same notation as tablebases use) to material signature
+     *
+     * @throws const char* if the signature is invalid
+     */
+    uint64_t parse_material_signature(const std::string& signature);
+
+    /**
+     * @brief Creates a database file. Records are written to the file immediately, solution moves, seeds and the index
+     * are kept in memory until finish() is called.
+     *
+     */
+    class Writer{
+
+        public:
+
+            /**
+             * @throws const char* if the file cannot be created
+             */
+            Writer(const std::string& path);
+
+            /**
+             * @brief adds the puzzle
+             *
+             * @param solution moves of the solution (at most 65535)
+             * @param generation_time time spent generating the puzzle in milliseconds
+             */
+            void add(Position* puzzle, int mate_moves, const std::vector<Move>& solution, const std::string& seed, uint32_t generation_time);
+
+            /**
+             * @brief writes the remaining sections and the header. No puzzles can be added after that
+             *
+             * @throws const char* if the file cannot be written
+             */
+            void finish();
+
+            // returns number of added puzzles
+            uint64_t size();
+
+        private:
+            std::ofstream m_file;
+            std::vector<uint16_t> m_moves;
+            std::vector<char> m_seeds;
+
+            // (mate moves, material) of the records
+            std::vector<std::pair<uint32_t, uint64_t>> m_keys;
+    };
+
+    /**
+     * @brief Read-only memory-mapped database
+     *
+     */
+    class Database{
+
+        public:
+
+            /**
+             * @throws const char* if the file cannot be opened or is not a puzzle database
+             */
+            Database(const std::string& path);
+            ~Database();
+
+            Database(const Database&) = delete;
+            Database& operator=(const Database&) = delete;
+
+            // returns number of puzzles
+            uint64_t size();
+
+            // returns i-th record (in place, no copying)
+            const PuzzleRecord& record(uint64_t i);
+
+            // returns the position of the i-th puzzle
+            Position get_position(uint64_t i);
+
+            // returns solution moves of the i-th puzzle (as moves of the position, so they can be performed)
+            std::vector<Move> get_solution(uint64_t i);
+
+            // returns seed of the i-th puzzle
+            const char* seed(uint64_t i);
+
+            // returns all groups of the index (sorted by mate length and material)
+            std::vector<IndexEntry> groups();
+
+            /**
+             * @brief returns numbers of records with given mate length (and material, if it is not 0) as a range [begin, end)
+             * of the sorted list of record numbers, which is stored in the file
+             */
+            std::pair<const uint32_t*, const uint32_t*> find(int mate_moves, uint64_t material=0);
+
+        private:
+            const uint8_t* m_data;
+            size_t m_length;
+            const PuzzleRecord* m_records;
+            const uint16_t* m_moves;
+            const char* m_seeds;
+            const IndexEntry* m_index;
+            const uint32_t* m_sorted;
+            uint64_t m_size;
+            uint64_t m_groups;
+    };
+
+}
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "position.h"
+#include "selfcheck.h"
+
+namespace SelfCheck{
+
+    // returns packed moves sorted, so that lists of moves generated in different order can be compared
+    std::vector<uint16_t> sorted_moves(const std::vector<Move>& moves){
+        auto result = std::vector<uint16_t>();
+        for(auto m : moves){
+            result.push_back(m.pack());
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    /**
+     * @brief Compares the fast generators and queries of Position with the slow reference which performs the moves
+     * (see Position::get_possible_moves_by_trying): get_possible_moves (evasions in check, both move filters), has_legal_moves,
+     * count_legal_moves, is_legal, in_check, get_checkers (cached, restored by undo_move and computed from FEN),
+     * gives_check and get_checking_moves.
+     *
+     * The positions come from random games (the same seed gives the same games), checking moves are preferred,
+     * so that many positions are in check.
+     *
+     * Writes every mismatch (what differs and the FEN) and a summary line.
+     *
+     * @return number of mismatches (0 if the generators agree with the reference)
+     */
+    uint64_t run(std::ostream& output, int games, const std::string& seed){
+        srand(std::hash<std::string>{}(seed));
+        uint64_t positions = 0;
+        uint64_t checks = 0;
+        uint64_t moves = 0;
+        uint64_t mismatches = 0;
+        Position position;
+        auto report = [&](const std::string& what){
+            mismatches++;
+            output << "mismatch " << what << ": " << position.get_fen() << std::endl;
+        };
+        for(int game = 0; game < games; game++){
+            position = Position();
+            while(position.ply() < MAX_GAME_PLIES && !position.is_draw()){
+                positions++;
+                bool white = position.m_to_move == 'w';
+                int own = white ? 0 : 1;
+                auto reference = position.get_possible_moves_by_trying();
+                auto expected = sorted_moves(reference);
+
+                // check detection: the cached mask, the mask computed from scratch and square_hit agree
+                bool in_check = position.m_kings[own] != -1 && position.square_hit(position.m_kings[own], !white);
+                uint64_t checkers = position.get_checkers();
+                checks += in_check;
+                if(position.in_check() != in_check){
+                    report("in_check");
+                }
+                if(Position(position.get_fen()).get_checkers() != checkers){
+                    report("get_checkers");
+                }
+
+                // legal moves (evasions in check)
+                if(sorted_moves(position.get_possible_moves()) != expected){
+                    report(in_check ? "evasions" : "get_possible_moves");
+                }
+                auto captures = position.get_possible_moves(MoveFilter::CAPTURES);
+                auto quiets = position.get_possible_moves(MoveFilter::QUIETS);
+                captures.insert(captures.end(), quiets.begin(), quiets.end());
+                if(sorted_moves(captures) != expected){
+                    report("move filters");
+                }
+                if(position.has_legal_moves() != !reference.empty()){
+                    report("has_legal_moves");
+                }
+                if(position.count_legal_moves(2) != std::min<int>(reference.size(), 2)){
+                    report("count_legal_moves");
+                }
+
+                // checking moves, decided without performing them
+                auto checking = std::vector<Move>();
+                for(auto m : reference){
+                    moves++;
+                    if(!position.is_legal(m)){
+                        report("is_legal " + m.to_full_string());
+                    }
+                    size_t hash = position.get_hash();
+                    position.perform_move(m);
+                    bool gives = position.m_kings[1 - own] != -1 && position.square_hit(position.m_kings[1 - own], white);
+                    position.undo_move();
+                    if(position.get_checkers() != checkers || position.get_hash() != hash){
+                        report("state after undo_move " + m.to_full_string());
+                    }
+                    if(position.gives_check(m) != gives){
+                        report("gives_check " + m.to_full_string());
+                    }
+                    if(gives){
+                        checking.push_back(m);
+                    }
+                }
+                if(sorted_moves(position.get_checking_moves()) != sorted_moves(checking)){
+                    report("get_checking_moves");
+                }
+
+                if(reference.empty()){
+                    break;
+                }
+                // checking moves are preferred, so that the games reach many positions in check
+                auto& pool = (!checking.empty() && rand() % 2 == 0) ? checking : reference;
+                position.perform_move(pool[rand() % pool.size()]);
+            }
+        }
+        output << "games: " << games << ", positions: " << positions << " (" << checks << " in check), moves: " << moves
+            << ", mismatches: " << mismatches << std::endl;
+        return mismatches;
+    }
+
+}
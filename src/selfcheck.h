@@ -0,0 +1,28 @@
+#pragma once
+
+#include "position.h"
+#include <iostream>
+#include <string>
+#include <cstdint>
+
+namespace SelfCheck{
+
+    // Maximal number of half-moves of one game of the self-check
+    const int MAX_GAME_PLIES = 200;
+
+    /**
+     * @brief Compares the fast generators and queries of Position with the slow reference which performs the moves
+     * (see Position::get_possible_moves_by_trying): get_possible_moves (evasions in check, both move filters), has_legal_moves,
+     * count_legal_moves, is_legal, in_check, get_checkers (cached, restored by undo_move and computed from FEN),
+     * gives_check and get_checking_moves.
+     *
+     * The positions come from random games (the same seed gives the same games), checking moves are preferred,
+     * so that many positions are in check.
+     *
+     * Writes every mismatch (what differs and the FEN) and a summary line.
+     *
+     * @return number of mismatches (0 if the generators agree with the reference)
+     */
+    uint64_t run(std::ostream& output, int games, const std::string& seed);
+
+}
@@ -0,0 +1,41 @@
+#include <vector>
+#include <cstdlib>
+#include "move.h"
+#include "solution_tree.h"
+
+/**
+ * @brief Construct empty tree (containing only root without children)
+ */
+SolutionTree::SolutionTree(){
+    m_nodes.push_back({Move(), 0, 0});
+    m_plies_to_mate = 0;
+}
+
+/**
+ * @brief returns index of the child of given node reached by the move or -1 if the move is not a solution
+ */
+int SolutionTree::find_child(int node, Move move){
+    for(int i = m_nodes[node].first_child; i < m_nodes[node].first_child + m_nodes[node].child_count; i++){
+        if(m_nodes[i].move == move){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief returns index of randomly chosen child of given node (uses rand())
+ */
+int SolutionTree::random_child(int node){
+    return m_nodes[node].first_child + rand() % m_nodes[node].child_count;
+}
+
+// returns true if the node is a mate position
+bool SolutionTree::is_leaf(int node){
+    return m_nodes[node].child_count == 0;
+}
+
+// returns number of nodes
+int SolutionTree::size(){
+    return m_nodes.size();
+}
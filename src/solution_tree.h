@@ -0,0 +1,57 @@
+#pragma once
+
+#include "move.h"
+#include <vector>
+
+/**
+ * @brief Tree of all solutions of a puzzle, so that the puzzle can be solved interactively without any search.
+ *
+ * Nodes of the attacker contain all moves leading to the fastest mate, nodes of the defender all moves of the best defense
+ * (moves which do not shorten the mate). Leaves are mate positions.
+ *
+ * The nodes are stored in one vector, children of a node are stored next to each other. Node 0 is the root (puzzle position),
+ * its move is not used.
+ */
+class SolutionTree{
+
+    public:
+
+        struct Node{
+
+            // move leading to this node
+            Move move;
+
+            // index of the first child in m_nodes
+            int first_child;
+
+            // number of children (0 for mate)
+            int child_count;
+        };
+
+        // all nodes of the tree, m_nodes[0] is the root
+        std::vector<Node> m_nodes;
+
+        // number of half-moves from the root to mate
+        int m_plies_to_mate;
+
+        /**
+         * @brief Construct empty tree (containing only root without children)
+         */
+        SolutionTree();
+
+        /**
+         * @brief returns index of the child of given node reached by the move or -1 if the move is not a solution
+         */
+        int find_child(int node, Move move);
+
+        /**
+         * @brief returns index of randomly chosen child of given node (uses rand())
+         */
+        int random_child(int node);
+
+        // returns true if the node is a mate position
+        bool is_leaf(int node);
+
+        // returns number of nodes
+        int size();
+};
@@ -0,0 +1,177 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "position.h"
+#include "engine.h"
+#include "solver.h"
+
+namespace Solver{
+
+    /**
+     * @brief Solves a single line of EPD/FEN file for mate.
+     *
+     * The line may be full FEN or EPD (4 FEN fields followed by EPD operations, which are ignored).
+     * Empty lines and lines starting with '#' are returned unchanged.
+     *
+     * @return the position as EPD followed by "dm <moves to mate>; pv <moves>;" (moves in long algebraic notation),
+     * or by a comment 'c0 "..."' if there is no mate within max_moves or the line is invalid
+     *
+     * @param cache cleared before the search, so that the result does not depend on previously solved lines
+     */
+    std::string solve_line(std::string_view line, int max_moves, Cache* cache){
+        if(line.length() > 0 && line.back() == '\r'){
+            line.remove_suffix(1);
+        }
+        size_t start = line.find_first_not_of(" \t");
+        if(start == std::string_view::npos || line[start] == '#'){
+            return std::string(line);
+        }
+
+        // find starts and ends of first 6 whitespace separated fields
+        size_t field_start[6];
+        size_t field_end[6];
+        int fields = 0;
+        for(size_t j = start; j < line.length() && fields < 6;){
+            field_start[fields] = j;
+            while(j < line.length() && line[j] != ' ' && line[j] != '\t'){
+                j++;
+            }
+            field_end[fields++] = j;
+            while(j < line.length() && (line[j] == ' ' || line[j] == '\t')){
+                j++;
+            }
+        }
+        // FEN has numeric 5th and 6th field, EPD has operations after 4th field
+        int fen_fields = fields >= 4 ? 4 : 0;
+        if(fields == 6 && isdigit((unsigned char)line[field_start[4]]) && isdigit((unsigned char)line[field_start[5]])){
+            fen_fields = 6;
+        }
+        // the fields may be separated by any blanks, the parser expects single spaces
+        std::string fen_text;
+        if(fen_fields == 0){
+            fen_text = line.substr(start);
+        }
+        for(int f = 0; f < fen_fields; f++){
+            if(f > 0){
+                fen_text += ' ';
+            }
+            fen_text += line.substr(field_start[f], field_end[f] - field_start[f]);
+        }
+
+        Position position;
+        FenError error = parse_fen(fen_text, &position);
+        if(error != FenError::OK){
+            return fen_text + " c0 \"" + fen_error_string(error) + "\";";
+        }
+
+        std::string fen = position.get_fen();
+        std::string result = fen.substr(0, fen.rfind(' ', fen.rfind(' ') - 1)); // strip the move counters
+        cache->clear();
+        Engine::clear_killers();
+        int eval = Engine::find_mate(&position, max_moves, cache);
+        if(abs(eval) < Engine::MATE_THRESHOLD){
+            return result + " c0 \"no mate in " + std::to_string(max_moves) + "\";";
+        }
+        result += " dm " + std::to_string(Engine::moves_to_mate(eval) * ((eval > 0) == (position.m_to_move == 'w') ? 1 : -1)) + "; pv";
+        // the mate is at most 2 * max_moves - 1 half-moves long (see Engine::find_mate), the line is not searched deeper
+        int pv_depth = std::min(Engine::MATE - abs(eval), 2 * max_moves - 1);
+        for(auto m : Engine::get_principal_variation(&position, pv_depth, cache)){
+            result += " " + m.to_full_string();
+        }
+        return result + ";";
+    }
+
+    /**
+     * @brief Line of the input waiting to be solved and written
+     */
+    struct Job{
+        std::string line;
+        std::string result;
+        bool done;
+    };
+
+    /**
+     * @brief Reads EPD/FEN lines from input and writes one solved line (see Solver::solve_line) per input line into output.
+     *
+     * Lines are solved in parallel by worker threads (each with its own cache), output keeps the order of input.
+     * Input is streamed, only a small window of lines is kept in memory.
+     */
+    void solve_stream(std::istream& input, std::ostream& output, int max_moves, int threads){
+        if(threads < 1){
+            threads = 1;
+        }
+        // jobs which were read but not written yet, front is the next line to be written.
+        // std::deque keeps references valid when pushing to back and popping from front
+        std::deque<Job> window;
+        size_t max_window = 4 * threads;
+        size_t taken = 0; // number of jobs in window already taken by workers
+        bool end_of_input = false;
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+
+        auto worker = [&](){
+            auto cache = Cache();
+            std::unique_lock<std::mutex> lock(mutex);
+            while(true){
+                work_ready.wait(lock, [&](){ return taken < window.size() || end_of_input; });
+                if(taken == window.size()){
+                    return; // end of input and no work left
+                }
+                Job* job = &window[taken++];
+                lock.unlock();
+                std::string result = solve_line(job->line, max_moves, &cache);
+                lock.lock();
+                job->result = std::move(result);
+                job->done = true;
+                work_done.notify_one();
+            }
+        };
+
+        auto workers = std::vector<std::thread>();
+        for(int i = 0; i < threads; i++){
+            workers.push_back(std::thread(worker));
+        }
+
+        // writes all solved lines from the front of the window, the lock has to be held
+        auto flush = [&](){
+            while(!window.empty() && window.front().done){
+                output << window.front().result << '\n';
+                window.pop_front();
+                taken--;
+            }
+            output.flush();
+        };
+
+        std::string line;
+        while(std::getline(input, line)){
+            std::unique_lock<std::mutex> lock(mutex);
+            flush();
+            while(window.size() >= max_window){
+                work_done.wait(lock);
+                flush();
+            }
+            window.push_back({std::move(line), "", false});
+            work_ready.notify_one();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            end_of_input = true;
+            work_ready.notify_all();
+            while(!window.empty()){
+                work_done.wait(lock, [&](){ return window.front().done; });
+                flush();
+            }
+        }
+        for(auto& t : workers){
+            t.join();
+        }
+    }
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "engine.h"
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace Solver{
+
+    /**
+     * @brief Solves a single line of EPD/FEN file for mate.
+     *
+     * The line may be full FEN or EPD (4 FEN fields followed by EPD operations, which are ignored).
+     * Empty lines and lines starting with '#' are returned unchanged.
+     *
+     * @return the position as EPD followed by "dm <moves to mate>; pv <moves>;" (moves in long algebraic notation),
+     * or by a comment 'c0 "..."' if there is no mate within max_moves or the line is invalid
+     *
+     * @param cache cleared before the search, so that the result does not depend on previously solved lines
+     */
+    std::string solve_line(std::string_view line, int max_moves, Cache* cache);
+
+    /**
+     * @brief Reads EPD/FEN lines from input and writes one solved line (see Solver::solve_line) per input line into output.
+     *
+     * Lines are solved in parallel by worker threads (each with its own cache), output keeps the order of input.
+     * Input is streamed, only a small window of lines is kept in memory.
+     */
+    void solve_stream(std::istream& input, std::ostream& output, int max_moves, int threads);
+
+}
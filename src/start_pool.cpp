@@ -0,0 +1,111 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include "position.h"
+#include "engine.h"
+#include "start_pool.h"
+
+// Range of half-moves played from the initial position in a generated game
+const int START_POOL_MIN_PLIES = 16;
+const int START_POOL_MAX_PLIES = 40;
+
+// Maximal absolute evaluation (in pawns) of a generated position, more decided positions are left to the generator
+const int START_POOL_MAX_EVAL = 3;
+
+/**
+ * @brief Construct empty pool (nothing is loaded or saved)
+ */
+StartPool::StartPool(){
+}
+
+/**
+ * @brief Construct the pool stored in the file (if the file does not exist, the pool is empty)
+ *
+ * @throws const char* if a line of the file is not a valid FEN
+ */
+StartPool::StartPool(const std::string& path){
+    m_path = path;
+    std::ifstream file(path);
+    std::string line;
+    Position position;
+    while(std::getline(file, line)){
+        if(line.empty() || line[0] == '#'){
+            continue;
+        }
+        if(parse_fen(line, &position) != FenError::OK){
+            throw "invalid FEN in start pool file";
+        }
+        m_positions.push_back(position);
+    }
+}
+
+// returns true if there are no positions in the pool
+bool StartPool::empty(){
+    return m_positions.empty();
+}
+
+// returns number of positions
+size_t StartPool::size(){
+    return m_positions.size();
+}
+
+// returns the position of given index (0 <= index < size())
+const Position& StartPool::get(size_t index){
+    return m_positions[index];
+}
+
+// adds the position to the pool (only the position is kept, not its history)
+void StartPool::add(Position* position){
+    m_positions.push_back(Position(position->get_fen()));
+}
+
+/**
+ * @brief adds count positions reached by the engine playing itself from the initial position (the same seed gives the same positions).
+ * Every game gives one position after a random number of half-moves. Only undecided positions (not in check,
+ * not drawn and with material balance evaluated within few pawns) are added, each position at most once
+ */
+void StartPool::generate(int count, const std::string& seed){
+    auto cache = Cache();
+    Engine::clear_killers();
+    srand(std::hash<std::string>{}(seed));
+    auto hashes = std::vector<size_t>();
+    for(auto& position : m_positions){
+        hashes.push_back(position.get_hash());
+    }
+    for(int added = 0; added < count;){
+        Position position = Position();
+        int plies = START_POOL_MIN_PLIES + rand() % (START_POOL_MAX_PLIES - START_POOL_MIN_PLIES + 1);
+        while(position.ply() < plies && !position.is_draw() && position.has_legal_moves()){
+            Engine::play_random_best(&position, Engine::MIN_DEPTH, &cache);
+        }
+        if(position.ply() < plies || position.in_check() || abs(Engine::evaluate(&position, Engine::MIN_DEPTH, &cache)) > START_POOL_MAX_EVAL){
+            continue;
+        }
+        if(std::find(hashes.begin(), hashes.end(), position.get_hash()) != hashes.end()){
+            continue;
+        }
+        hashes.push_back(position.get_hash());
+        add(&position);
+        added++;
+    }
+}
+
+/**
+ * @brief writes the positions into the file given in constructor (does nothing for pool without a file)
+ *
+ * @throws const char* if the file cannot be written
+ */
+void StartPool::save(){
+    if(m_path.empty()){
+        return;
+    }
+    std::ofstream file(m_path, std::ios::trunc);
+    for(auto& position : m_positions){
+        file << position.get_fen() << std::endl;
+    }
+    if(!file){
+        throw "cannot write start pool file";
+    }
+}
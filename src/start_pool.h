@@ -0,0 +1,63 @@
+#pragma once
+
+#include "position.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Number of positions of a generated pool (see StartPool::generate)
+const int START_POOL_SIZE = 256;
+
+/**
+ * @brief Pool of middlegame positions, from which the generator starts its games (see Engine::GenerationOptions::start_pool),
+ * so that the games do not spend their moves by playing through the opening.
+ *
+ * The positions are stored as text file with one FEN per line (empty lines and lines starting with '#' are ignored),
+ * so that the pool can be also written by hand. A pool can be generated by the engine (see StartPool::generate) and saved.
+ */
+class StartPool{
+
+    public:
+
+        /**
+         * @brief Construct empty pool (nothing is loaded or saved)
+         */
+        StartPool();
+
+        /**
+         * @brief Construct the pool stored in the file (if the file does not exist, the pool is empty)
+         *
+         * @throws const char* if a line of the file is not a valid FEN
+         */
+        StartPool(const std::string& path);
+
+        // returns true if there are no positions in the pool
+        bool empty();
+
+        // returns number of positions
+        size_t size();
+
+        // returns the position of given index (0 <= index < size())
+        const Position& get(size_t index);
+
+        // adds the position to the pool (only the position is kept, not its history)
+        void add(Position* position);
+
+        /**
+         * @brief adds count positions reached by the engine playing itself from the initial position (the same seed gives the same positions).
+         * Every game gives one position after a random number of half-moves. Only undecided positions (not in check,
+         * not drawn and with material balance evaluated within few pawns) are added, each position at most once
+         */
+        void generate(int count, const std::string& seed);
+
+        /**
+         * @brief writes the positions into the file given in constructor (does nothing for pool without a file)
+         *
+         * @throws const char* if the file cannot be written
+         */
+        void save();
+
+    private:
+        std::string m_path;
+        std::vector<Position> m_positions;
+};
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include "statistics.h"
+
+namespace Engine{
+
+    thread_local Statistics statistics;
+
+    // starts measuring an iteration
+    void SearchStats::start_iteration(){
+        m_before = statistics;
+        statistics.max_ply = 0;
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    // finishes measuring the iteration of given depth
+    void SearchStats::finish_iteration(int depth){
+        IterationStats iteration;
+        iteration.depth = depth;
+        iteration.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        iteration.nodes = statistics.nodes - m_before.nodes;
+        iteration.qnodes = statistics.leaf_nodes - m_before.leaf_nodes;
+        iteration.tt_hits = statistics.tt_hits - m_before.tt_hits;
+        iteration.tt_probes = iteration.tt_hits + statistics.tt_misses - m_before.tt_misses;
+        iteration.cutoffs = 0;
+        for(int ply = 0; ply < MAX_STATISTICS_PLY; ply++){
+            iteration.cutoffs += statistics.cutoffs[ply] - m_before.cutoffs[ply];
+        }
+        iteration.first_move_cutoffs = statistics.first_move_cutoffs - m_before.first_move_cutoffs;
+        iteration.max_ply = statistics.max_ply;
+        statistics.max_ply = std::max(statistics.max_ply, m_before.max_ply);
+        iterations.push_back(iteration);
+        update_derived();
+    }
+
+    // recomputes nodes per second and branching factors after the iterations changed
+    void SearchStats::update_derived(){
+        for(size_t i = 0; i < iterations.size(); i++){
+            auto& iteration = iterations[i];
+            iteration.nps = iteration.time > 0 ? iteration.nodes / iteration.time : 0;
+            iteration.branching_factor = 0;
+            if(i > 0 && iterations[i-1].nodes > 0 && iteration.depth > iterations[i-1].depth){
+                // iterations may step by more half-moves (e.g. Engine::find_fastest_mate steps by whole moves)
+                double ratio = (double)iteration.nodes / iterations[i-1].nodes;
+                iteration.branching_factor = pow(ratio, 1.0 / (iteration.depth - iterations[i-1].depth));
+            }
+        }
+    }
+
+    // adds the iterations of other search to the iterations of the same depth (new depths are inserted in order),
+    // so that searches of several positions give one table
+    void SearchStats::add(const SearchStats& other){
+        for(auto& iteration : other.iterations){
+            auto it = std::lower_bound(iterations.begin(), iterations.end(), iteration.depth,
+                [](const IterationStats& i, int depth){ return i.depth < depth; });
+            if(it == iterations.end() || it->depth != iteration.depth){
+                iterations.insert(it, iteration);
+                continue;
+            }
+            it->nodes += iteration.nodes;
+            it->qnodes += iteration.qnodes;
+            it->time += iteration.time;
+            it->tt_probes += iteration.tt_probes;
+            it->tt_hits += iteration.tt_hits;
+            it->cutoffs += iteration.cutoffs;
+            it->first_move_cutoffs += iteration.first_move_cutoffs;
+            it->max_ply = std::max(it->max_ply, iteration.max_ply);
+        }
+        update_derived();
+    }
+
+    // returns printable table of the iterations
+    std::string SearchStats::to_string(){
+        std::ostringstream result;
+        result << "depth      nodes     qnodes        nps    ebf  tt hits  first cut  max depth" << std::endl;
+        result << std::fixed;
+        for(auto& i : iterations){
+            result << std::setw(5) << i.depth
+                << std::setw(11) << i.nodes
+                << std::setw(11) << i.qnodes
+                << std::setw(11) << std::setprecision(0) << i.nps
+                << std::setw(7) << std::setprecision(2) << i.branching_factor
+                << std::setw(8) << std::setprecision(1) << (i.tt_probes > 0 ? 100.0 * i.tt_hits / i.tt_probes : 0) << "%"
+                << std::setw(10) << std::setprecision(1) << (i.cutoffs > 0 ? 100.0 * i.first_move_cutoffs / i.cutoffs : 0) << "%"
+                << std::setw(11) << i.max_ply << std::endl;
+        }
+        return result.str();
+    }
+
+    /**
+     * @brief writes the statistics as one line of JSON (with derived nodes per second and puzzles per second)
+     *
+     * @param elapsed time in seconds, in which the statistics were collected
+     */
+    void write_statistics_json(std::ostream& output, const Statistics& stats, double elapsed){
+        // cutoffs are written up to the deepest ply with any cutoff
+        int plies = MAX_STATISTICS_PLY;
+        while(plies > 0 && stats.cutoffs[plies - 1] == 0){
+            plies--;
+        }
+        output << "{\"elapsed\":" << elapsed
+            << ",\"nodes\":" << stats.nodes
+            << ",\"nps\":" << (elapsed > 0 ? stats.nodes / elapsed : 0)
+            << ",\"tt_hits\":" << stats.tt_hits
+            << ",\"tt_misses\":" << stats.tt_misses
+            << ",\"cutoffs\":[";
+        for(int ply = 0; ply < plies; ply++){
+            output << (ply > 0 ? "," : "") << stats.cutoffs[ply];
+        }
+        output << "],\"games\":" << stats.games
+            << ",\"restarts\":" << stats.restarts
+            << ",\"abandoned_games\":" << stats.abandoned_games
+            << ",\"puzzle_restarts\":" << stats.puzzle_restarts
+            << ",\"puzzles\":" << stats.puzzles
+            << ",\"random_play_time\":" << stats.random_play_time
+            << ",\"reinforcement_time\":" << stats.reinforcement_time
+            << ",\"puzzles_per_second\":" << (elapsed > 0 ? stats.puzzles / elapsed : 0)
+            << "}" << std::endl;
+    }
+
+    /**
+     * @param interval minimal time between two lines in seconds
+     */
+    StatisticsLog::StatisticsLog(std::ostream* output, double interval){
+        m_output = output;
+        m_interval = interval;
+        m_start = std::chrono::steady_clock::now();
+        m_last = m_start;
+    }
+
+    // writes the line if the interval passed since the last one, called by the generator regularly
+    void StatisticsLog::tick(){
+        if(std::chrono::duration<double>(std::chrono::steady_clock::now() - m_last).count() >= m_interval){
+            write();
+        }
+    }
+
+    // writes the line now
+    void StatisticsLog::write(){
+        m_last = std::chrono::steady_clock::now();
+        write_statistics_json(*m_output, statistics, std::chrono::duration<double>(m_last - m_start).count());
+    }
+
+}
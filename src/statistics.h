@@ -0,0 +1,157 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace Engine{
+
+    // Cutoffs are counted separately for plies 0 .. MAX_STATISTICS_PLY - 1, deeper cutoffs are counted in the last ply
+    const int MAX_STATISTICS_PLY = 32;
+
+    /**
+     * @brief Counters of the search and of the puzzle generation (see Engine::statistics)
+     *
+     */
+    struct Statistics{
+
+        // calls of Engine::evaluate
+        uint64_t nodes = 0;
+
+        // nodes evaluated statically (by material) at the end of the search, the engine has no quiescence search
+        uint64_t leaf_nodes = 0;
+
+        // cache lookups which found the position
+        uint64_t tt_hits = 0;
+
+        // cache lookups which did not find the position
+        uint64_t tt_misses = 0;
+
+        // alfa-beta cutoffs by the distance from the root of the search
+        uint64_t cutoffs[MAX_STATISTICS_PLY] = {};
+
+        // cutoffs caused by the first searched move
+        uint64_t first_move_cutoffs = 0;
+
+        // maximal distance from the root of the search reached
+        int max_ply = 0;
+
+        // games played by the generator
+        uint64_t games = 0;
+
+        // games thrown away by the generator (longer than 150 half-moves, drawn or ended without a mate)
+        uint64_t restarts = 0;
+
+        // games abandoned by the generator, because their budget was exhausted (see GenerationOptions::game_limits)
+        uint64_t abandoned_games = 0;
+
+        // restarts of the generator from a derived seed, because the budget of the puzzle was exhausted (see GenerationOptions::puzzle_limits)
+        uint64_t puzzle_restarts = 0;
+
+        // generated puzzles
+        uint64_t puzzles = 0;
+
+        // time (in seconds) spent by random play and by reinforcement of the puzzles
+        double random_play_time = 0;
+        double reinforcement_time = 0;
+    };
+
+    /**
+     * @brief Counters of the current thread. They are only increased by the engine, the caller may reset them.
+     */
+    extern thread_local Statistics statistics;
+
+    /**
+     * @brief Statistics of one iteration of iterated search
+     *
+     */
+    struct IterationStats{
+        int depth;
+        uint64_t nodes;
+
+        // leaf nodes (see Statistics::leaf_nodes)
+        uint64_t qnodes;
+
+        // time of the iteration in seconds
+        double time;
+
+        // nodes per second
+        double nps;
+
+        // effective branching factor per half-move, ratio of nodes of this and of the previous iteration normalized
+        // by the difference of their depths (0 for the first iteration)
+        double branching_factor;
+
+        uint64_t tt_probes;
+        uint64_t tt_hits;
+        uint64_t cutoffs;
+        uint64_t first_move_cutoffs;
+
+        // maximal distance from the root reached
+        int max_ply;
+    };
+
+    /**
+     * @brief Statistics of iterated search, filled by the search per iteration (see Engine::iter_evaluate)
+     *
+     */
+    struct SearchStats{
+        std::vector<IterationStats> iterations;
+
+        // starts measuring an iteration
+        void start_iteration();
+
+        // finishes measuring the iteration of given depth
+        void finish_iteration(int depth);
+
+        // adds the iterations of other search to the iterations of the same depth (new depths are inserted in order),
+        // so that searches of several positions give one table
+        void add(const SearchStats& other);
+
+        // returns printable table of the iterations
+        std::string to_string();
+
+        private:
+            // recomputes nodes per second and branching factors after the iterations changed
+            void update_derived();
+
+            Statistics m_before;
+            std::chrono::steady_clock::time_point m_start;
+    };
+
+    /**
+     * @brief writes the statistics as one line of JSON (with derived nodes per second and puzzles per second)
+     *
+     * @param elapsed time in seconds, in which the statistics were collected
+     */
+    void write_statistics_json(std::ostream& output, const Statistics& stats, double elapsed);
+
+    /**
+     * @brief Periodically writes statistics of the current thread as JSON lines (see Engine::write_statistics_json)
+     *
+     */
+    class StatisticsLog{
+
+        public:
+
+            /**
+             * @param interval minimal time between two lines in seconds
+             */
+            StatisticsLog(std::ostream* output, double interval);
+
+            // writes the line if the interval passed since the last one, called by the generator regularly
+            void tick();
+
+            // writes the line now
+            void write();
+
+        private:
+            std::ostream* m_output;
+            double m_interval;
+            std::chrono::steady_clock::time_point m_start;
+            std::chrono::steady_clock::time_point m_last;
+    };
+
+}
@@ -0,0 +1,869 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "position.h"
+#include "tablebase.h"
+
+namespace Tablebase{
+
+    // Values stored in the tables. Other values v mean mate in (v - 1) half-moves, for odd number of half-moves
+    // the player to move mates, for even number the player to move gets mated
+    const uint8_t DRAW_VALUE = 0;
+    const uint8_t INVALID_VALUE = 255;
+
+    // Table file is the header (magic and number of entries) followed by one byte per position
+    const char FILE_MAGIC[8] = {'T', 'A', 'C', 'T', 'D', 'T', 'M', '1'};
+    const int HEADER_SIZE = 16;
+
+    // Order of pieces in the signatures, stronger pieces first
+    const std::string PIECE_ORDER = "QRBNP";
+
+    // Upper bound of number of legal moves (or un-moves) in a position with at most MAX_PIECES pieces
+    const int MAX_CHILDREN = 128;
+
+    /**
+     * @brief Small position used by the tables. Kings are always the first two pieces (white king first).
+     *
+     */
+    struct Pieces{
+        int n;
+        char piece[MAX_PIECES];
+        int square[MAX_PIECES];
+        bool white_to_move;
+    };
+
+    /**
+     * @brief Layout of a table: order of the pieces in the index and the number of entries
+     *
+     * The index of a position is (side to move, slot of white king, squares of other pieces). The white king is moved
+     * by a symmetry of the board to a triangle a1-d1-d4 (10 slots) or to files a-d if there are pawns (32 slots).
+     * Of all symmetric images the one with the smallest index is used, so every position has exactly one index.
+     */
+    struct Layout{
+        int n;
+        char piece[MAX_PIECES];
+        bool pawns;
+        int slots;
+        size_t size;
+    };
+
+    /**
+     * @brief Loaded or built table
+     *
+     */
+    struct Table{
+        Layout layout;
+        const uint8_t* data;
+
+        // values of the table built in this process (data points into it), empty for memory-mapped tables
+        std::vector<uint8_t> memory;
+    };
+
+    // all available tables by signature
+    std::map<std::string, Table> tables;
+
+    // Number of material keys of one side: the side has at most two pieces besides the king, each coded by its rank
+    // in PIECE_ORDER plus one (0 for no piece), the key is 6 * (code of the stronger piece) + code of the weaker one
+    const int SIDE_KEYS = 36;
+
+    /**
+     * @brief Table of the material key (see Tablebase::get_material_key)
+     *
+     */
+    struct MaterialEntry{
+        const Table* table;
+
+        // true if the stronger side of the table is black in the material (colors have to be swapped)
+        bool flipped;
+    };
+
+    // available tables by material key, so the probe does not build the signature
+    MaterialEntry materials[SIDE_KEYS * SIDE_KEYS];
+
+    /**
+     * @brief Precomputed symmetries of the board and king slots
+     *
+     */
+    struct Symmetries{
+
+        // square after applying the symmetry (bit 1 mirrors files, bit 2 mirrors ranks, bit 4 swaps files and ranks)
+        int transform[8][64];
+
+        // slot of the king on the square or -1 (index 0 for tables without pawns, 1 for tables with pawns)
+        int king_slot[2][64];
+
+        // square of the king slot
+        int slot_square[2][32];
+
+        Symmetries(){
+            for(int t = 0; t < 8; t++){
+                for(int square = 0; square < 64; square++){
+                    int col = square % 8;
+                    int row = square / 8;
+                    if(t & 4){
+                        std::swap(col, row);
+                    }
+                    if(t & 1){
+                        col = 7 - col;
+                    }
+                    if(t & 2){
+                        row = 7 - row;
+                    }
+                    transform[t][square] = row * 8 + col;
+                }
+            }
+            int slots[2] = {0, 0};
+            for(int square = 0; square < 64; square++){
+                int col = square % 8;
+                int rank = 7 - square / 8;
+                king_slot[0][square] = -1;
+                king_slot[1][square] = -1;
+                if(col <= 3 && rank <= col){
+                    slot_square[0][slots[0]] = square;
+                    king_slot[0][square] = slots[0]++;
+                }
+                if(col <= 3){
+                    slot_square[1][slots[1]] = square;
+                    king_slot[1][square] = slots[1]++;
+                }
+            }
+        }
+    };
+
+    const Symmetries symmetries;
+
+    // returns rank of the piece in PIECE_ORDER (kings first)
+    int piece_rank(char piece){
+        if(toupper(piece) == 'K'){
+            return -1;
+        }
+        return PIECE_ORDER.find(toupper(piece));
+    }
+
+    /**
+     * @brief returns key of the material of the pieces (kings are ignored) in range [0, SIDE_KEYS * SIDE_KEYS),
+     * white side key is the higher digit. At most two pieces of each side besides the king are expected.
+     */
+    int get_material_key(const char* piece, int n){
+        int codes[2][2] = {};
+        for(int i = 0; i < n; i++){
+            if(toupper(piece[i]) == 'K'){
+                continue;
+            }
+            int* side = codes[is_upper(piece[i]) ? 0 : 1];
+            side[side[0] == 0 ? 0 : 1] = piece_rank(piece[i]) + 1;
+        }
+        int key = 0;
+        for(auto side : codes){
+            if(side[1] != 0 && side[1] < side[0]){
+                std::swap(side[0], side[1]);
+            }
+            key = key * SIDE_KEYS + side[0] * 6 + side[1];
+        }
+        return key;
+    }
+
+    // returns true if the side given by its pieces (e.g. "KQR") is stronger than the other side
+    bool is_stronger(const std::string& side, const std::string& other){
+        if(side.length() != other.length()){
+            return side.length() > other.length();
+        }
+        for(size_t i = 0; i < side.length(); i++){
+            if(piece_rank(side[i]) != piece_rank(other[i])){
+                return piece_rank(side[i]) < piece_rank(other[i]);
+            }
+        }
+        return false;
+    }
+
+    // sorts pieces of one side (e.g. "RKQ" -> "KQR"), the result is in upper case
+    std::string side_signature(std::string side){
+        for(auto& c : side){
+            c = toupper(c);
+        }
+        std::sort(side.begin(), side.end(), [](char a, char b){ return piece_rank(a) < piece_rank(b); });
+        return side;
+    }
+
+    /**
+     * @brief returns signature of the material with the stronger side first
+     *
+     * @param flipped set to true if black is the stronger side (the colors have to be swapped to look the position up)
+     */
+    std::string get_signature(const std::string& white, const std::string& black, bool* flipped){
+        std::string w = side_signature(white);
+        std::string b = side_signature(black);
+        *flipped = is_stronger(b, w);
+        return *flipped ? b + "v" + w : w + "v" + b;
+    }
+
+    /**
+     * @brief returns layout of the table (see Tablebase::Layout)
+     *
+     * @throws const char* if the signature is not supported
+     */
+    Layout get_layout(const std::string& signature){
+        size_t separator = signature.find('v');
+        if(separator == std::string::npos || signature.find_first_not_of("KQRBNPv") != std::string::npos
+            || std::count(signature.begin(), signature.end(), 'K') != 2){
+            throw "invalid tablebase signature";
+        }
+        std::string white = signature.substr(0, separator);
+        std::string black = signature.substr(separator + 1);
+        bool flipped;
+        if(get_signature(white, black, &flipped) != signature || flipped || white[0] != 'K' || black[0] != 'K'){
+            throw "invalid tablebase signature";
+        }
+        if(signature.length() - 1 < 3 || signature.length() - 1 > MAX_PIECES){
+            throw "unsupported number of pieces in tablebase signature";
+        }
+        if(white.find('P') != std::string::npos && black.find('P') != std::string::npos){
+            throw "tablebases with pawns of both sides are not supported";
+        }
+        Layout layout;
+        layout.n = 0;
+        layout.piece[layout.n++] = 'K';
+        layout.piece[layout.n++] = 'k';
+        for(size_t i = 1; i < white.length(); i++){
+            layout.piece[layout.n++] = white[i];
+        }
+        for(size_t i = 1; i < black.length(); i++){
+            layout.piece[layout.n++] = tolower(black[i]);
+        }
+        layout.pawns = signature.find('P') != std::string::npos;
+        layout.slots = layout.pawns ? 32 : 10;
+        layout.size = 2 * layout.slots;
+        for(int i = 1; i < layout.n; i++){
+            layout.size *= 64;
+        }
+        return layout;
+    }
+
+    /**
+     * @brief returns all supported material signatures (e.g. "KRvK", "KQvKR"), the stronger side is always first
+     */
+    std::vector<std::string> all_signatures(){
+        std::set<std::string> result;
+        std::vector<std::string> sides = {""};
+        for(char a : PIECE_ORDER){
+            sides.push_back(std::string(1, a));
+            for(char b : PIECE_ORDER){
+                sides.push_back(std::string(1, a) + b);
+            }
+        }
+        for(auto& white : sides){
+            for(auto& black : sides){
+                int pieces = 2 + white.length() + black.length();
+                bool both_pawns = white.find('P') != std::string::npos && black.find('P') != std::string::npos;
+                if(pieces >= 3 && pieces <= MAX_PIECES && !both_pawns){
+                    bool flipped;
+                    result.insert(get_signature("K" + white, "K" + black, &flipped));
+                }
+            }
+        }
+        return std::vector<std::string>(result.begin(), result.end());
+    }
+
+    /**
+     * @brief returns index of the position in the table. The pieces have to be in the order of the layout
+     * (only identical pieces may be swapped)
+     */
+    size_t get_index(const Layout& layout, const Pieces& position){
+        size_t best = layout.size;
+        int transforms = layout.pawns ? 2 : 8;
+        for(int t = 0; t < transforms; t++){
+            int king = symmetries.king_slot[layout.pawns][symmetries.transform[t][position.square[0]]];
+            if(king < 0){
+                continue;
+            }
+            int squares[MAX_PIECES];
+            for(int i = 1; i < layout.n; i++){
+                squares[i] = symmetries.transform[t][position.square[i]];
+            }
+            // identical pieces are interchangeable (only the last two pieces can be identical)
+            if(layout.n == 4 && layout.piece[2] == layout.piece[3] && squares[2] > squares[3]){
+                std::swap(squares[2], squares[3]);
+            }
+            size_t index = (position.white_to_move ? 0 : 1) * layout.slots + king;
+            for(int i = 1; i < layout.n; i++){
+                index = index * 64 + squares[i];
+            }
+            best = std::min(best, index);
+        }
+        return best;
+    }
+
+    // inverse of Tablebase::get_index
+    Pieces get_position(const Layout& layout, size_t index){
+        Pieces position;
+        position.n = layout.n;
+        for(int i = layout.n - 1; i >= 1; i--){
+            position.piece[i] = layout.piece[i];
+            position.square[i] = index % 64;
+            index /= 64;
+        }
+        position.piece[0] = layout.piece[0];
+        position.square[0] = symmetries.slot_square[layout.pawns][index % layout.slots];
+        position.white_to_move = index / layout.slots == 0;
+        return position;
+    }
+
+    // returns true if the piece standing on square from attacks square to (occupied[square] is true for non-empty squares)
+    bool attacks(char piece, int from, int to, const bool* occupied){
+        int dcol = to % 8 - from % 8;
+        int drow = to / 8 - from / 8;
+        switch(toupper(piece)){
+            case 'K':
+                return from != to && abs(dcol) <= 1 && abs(drow) <= 1;
+            case 'N':
+                return abs(dcol * drow) == 2;
+            case 'P':
+                return abs(dcol) == 1 && drow == (is_upper(piece) ? -1 : 1);
+            case 'R':
+                if(dcol != 0 && drow != 0){
+                    return false;
+                }
+                break;
+            case 'B':
+                if(abs(dcol) != abs(drow)){
+                    return false;
+                }
+                break;
+            case 'Q':
+                if(dcol != 0 && drow != 0 && abs(dcol) != abs(drow)){
+                    return false;
+                }
+                break;
+        }
+        if(from == to){
+            return false;
+        }
+        // slider, all squares in between have to be empty
+        int step = (drow > 0 ? 8 : (drow < 0 ? -8 : 0)) + (dcol > 0 ? 1 : (dcol < 0 ? -1 : 0));
+        for(int square = from + step; square != to; square += step){
+            if(occupied[square]){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // returns true if the king of given side is attacked
+    bool in_check(const Pieces& position, bool white){
+        bool occupied[64] = {};
+        for(int i = 0; i < position.n; i++){
+            occupied[position.square[i]] = true;
+        }
+        int king = position.square[white ? 0 : 1];
+        for(int i = 0; i < position.n; i++){
+            if(is_upper(position.piece[i]) != white && attacks(position.piece[i], position.square[i], king, occupied)){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief generates all positions after legal moves of the player to move
+     *
+     * @param exits set to true for captures and promotions (the child belongs to other table)
+     * @return number of children
+     */
+    int get_children(const Pieces& position, Pieces* children, bool* exits){
+        static const int king_steps[8][2] = {{-1,-1},{-1,0},{-1,1},{0,-1},{0,1},{1,-1},{1,0},{1,1}};
+        static const int knight_jumps[8][2] = {{-2,-1},{-2,1},{-1,-2},{-1,2},{1,-2},{1,2},{2,-1},{2,1}};
+        int board[64];
+        std::fill(board, board + 64, -1);
+        for(int i = 0; i < position.n; i++){
+            board[position.square[i]] = i;
+        }
+        int count = 0;
+
+        // adds the child after moving piece i to the square (possibly capturing and promoting)
+        auto add = [&](int i, int to, char promotion){
+            Pieces child = position;
+            int captured = board[to];
+            child.square[i] = to;
+            if(promotion != 0){
+                child.piece[i] = promotion;
+            }
+            if(captured >= 0){
+                for(int j = captured; j < child.n - 1; j++){
+                    child.piece[j] = child.piece[j + 1];
+                    child.square[j] = child.square[j + 1];
+                }
+                child.n--;
+            }
+            child.white_to_move = !position.white_to_move;
+            if(!in_check(child, position.white_to_move)){
+                exits[count] = captured >= 0 || promotion != 0;
+                children[count++] = child;
+            }
+        };
+
+        for(int i = 0; i < position.n; i++){
+            char piece = position.piece[i];
+            if(is_upper(piece) != position.white_to_move){
+                continue;
+            }
+            int from = position.square[i];
+            int col = from % 8;
+            int row = from / 8;
+            // returns true if the piece can move to the square (empty or opponent's piece, kings cannot be captured)
+            auto can_enter = [&](int square){
+                return board[square] < 0 || (is_upper(position.piece[board[square]]) != position.white_to_move && board[square] > 1);
+            };
+            switch(toupper(piece)){
+                case 'K':
+                case 'N': {
+                    auto steps = toupper(piece) == 'K' ? king_steps : knight_jumps;
+                    for(int s = 0; s < 8; s++){
+                        if(are_valid_coords(col + steps[s][0], row + steps[s][1]) && can_enter(from + steps[s][0] + 8 * steps[s][1])){
+                            add(i, from + steps[s][0] + 8 * steps[s][1], 0);
+                        }
+                    }
+                    break;
+                }
+                case 'P': {
+                    int direction = is_upper(piece) ? -1 : 1;
+                    int last_row = is_upper(piece) ? 0 : 7;
+                    int start_row = is_upper(piece) ? 6 : 1;
+                    auto add_pawn = [&](int to){
+                        if(to / 8 == last_row){
+                            for(char promotion : PIECE_ORDER.substr(0, 4)){
+                                add(i, to, is_upper(piece) ? promotion : tolower(promotion));
+                            }
+                        } else {
+                            add(i, to, 0);
+                        }
+                    };
+                    int forward = from + 8 * direction;
+                    if(board[forward] < 0){
+                        add_pawn(forward);
+                        if(row == start_row && board[forward + 8 * direction] < 0){
+                            add_pawn(forward + 8 * direction);
+                        }
+                    }
+                    for(int dcol = -1; dcol <= 1; dcol += 2){
+                        if(are_valid_coords(col + dcol, row) && board[forward + dcol] >= 0 && can_enter(forward + dcol)){
+                            add_pawn(forward + dcol);
+                        }
+                    }
+                    break;
+                }
+                default: {
+                    bool straight = toupper(piece) != 'B';
+                    bool diagonal = toupper(piece) != 'R';
+                    for(int s = 0; s < 8; s++){
+                        bool is_diagonal = king_steps[s][0] != 0 && king_steps[s][1] != 0;
+                        if((is_diagonal && !diagonal) || (!is_diagonal && !straight)){
+                            continue;
+                        }
+                        for(int c = col + king_steps[s][0], r = row + king_steps[s][1]; are_valid_coords(c, r); c += king_steps[s][0], r += king_steps[s][1]){
+                            if(!can_enter(r * 8 + c)){
+                                break;
+                            }
+                            add(i, r * 8 + c, 0);
+                            if(board[r * 8 + c] >= 0){
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief generates all positions (of the same table), from which the position can be reached by one move
+     * (the moves are un-done, captures and promotions are not un-done). The parents may be illegal.
+     *
+     * @return number of parents
+     */
+    int get_parents(const Pieces& position, Pieces* parents){
+        static const int king_steps[8][2] = {{-1,-1},{-1,0},{-1,1},{0,-1},{0,1},{1,-1},{1,0},{1,1}};
+        static const int knight_jumps[8][2] = {{-2,-1},{-2,1},{-1,-2},{-1,2},{1,-2},{1,2},{2,-1},{2,1}};
+        bool occupied[64] = {};
+        for(int i = 0; i < position.n; i++){
+            occupied[position.square[i]] = true;
+        }
+        int count = 0;
+        auto add = [&](int i, int from){
+            Pieces parent = position;
+            parent.square[i] = from;
+            parent.white_to_move = !position.white_to_move;
+            parents[count++] = parent;
+        };
+        for(int i = 0; i < position.n; i++){
+            char piece = position.piece[i];
+            if(is_upper(piece) == position.white_to_move){
+                // only the player, who is not to move, played the last move
+                continue;
+            }
+            int to = position.square[i];
+            int col = to % 8;
+            int row = to / 8;
+            switch(toupper(piece)){
+                case 'K':
+                case 'N': {
+                    auto steps = toupper(piece) == 'K' ? king_steps : knight_jumps;
+                    for(int s = 0; s < 8; s++){
+                        int from = to + steps[s][0] + 8 * steps[s][1];
+                        if(are_valid_coords(col + steps[s][0], row + steps[s][1]) && !occupied[from]){
+                            add(i, from);
+                        }
+                    }
+                    break;
+                }
+                case 'P': {
+                    // the pawn came from the opposite direction, it could not stand on its first rank
+                    int direction = is_upper(piece) ? 1 : -1;
+                    int first_row = is_upper(piece) ? 7 : 0;
+                    int double_row = is_upper(piece) ? 4 : 3;
+                    int from = to + 8 * direction;
+                    if(from / 8 != first_row && !occupied[from]){
+                        add(i, from);
+                        if(row == double_row && !occupied[from + 8 * direction]){
+                            add(i, from + 8 * direction);
+                        }
+                    }
+                    break;
+                }
+                default: {
+                    bool straight = toupper(piece) != 'B';
+                    bool diagonal = toupper(piece) != 'R';
+                    for(int s = 0; s < 8; s++){
+                        bool is_diagonal = king_steps[s][0] != 0 && king_steps[s][1] != 0;
+                        if((is_diagonal && !diagonal) || (!is_diagonal && !straight)){
+                            continue;
+                        }
+                        for(int c = col + king_steps[s][0], r = row + king_steps[s][1]; are_valid_coords(c, r) && !occupied[r * 8 + c]; c += king_steps[s][0], r += king_steps[s][1]){
+                            add(i, r * 8 + c);
+                        }
+                    }
+                }
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief looks up the value of the position of any material (the pieces may be in any order, kings first)
+     *
+     * @return false if the table is not available
+     */
+    bool lookup(const Pieces& position, uint8_t* value){
+        if(position.n == 2){
+            *value = DRAW_VALUE;
+            return true;
+        }
+        const MaterialEntry& entry = materials[get_material_key(position.piece, position.n)];
+        if(entry.table == nullptr){
+            return false;
+        }
+        bool flipped = entry.flipped;
+        const Layout& layout = entry.table->layout;
+
+        // put the pieces into the order of the layout, swap colors if the stronger side is black
+        Pieces ordered;
+        ordered.n = position.n;
+        ordered.white_to_move = position.white_to_move != flipped;
+        bool used[MAX_PIECES] = {};
+        for(int j = 0; j < layout.n; j++){
+            for(int i = 0; i < position.n; i++){
+                char piece = flipped ? (is_upper(position.piece[i]) ? tolower(position.piece[i]) : toupper(position.piece[i])) : position.piece[i];
+                if(!used[i] && piece == layout.piece[j]){
+                    used[i] = true;
+                    ordered.piece[j] = piece;
+                    ordered.square[j] = flipped ? position.square[i] ^ 56 : position.square[i];
+                    break;
+                }
+            }
+        }
+        *value = entry.table->data[get_index(layout, ordered)];
+        return true;
+    }
+
+    // returns signatures of the tables reachable by a capture or a promotion
+    std::vector<std::string> get_dependencies(const Layout& layout){
+        std::set<std::string> result;
+        for(int i = 2; i < layout.n; i++){
+            for(int captured = -1; captured < layout.n; captured++){
+                // each piece may be captured, pawns may also promote (with or without a capture)
+                bool promotes = toupper(layout.piece[i]) == 'P';
+                if(captured == i || captured == 0 || captured == 1 || (captured == -1 && !promotes)){
+                    continue;
+                }
+                for(char promotion : promotes ? PIECE_ORDER.substr(0, 4) + " " : std::string(" ")){
+                    if(captured == -1 && promotion == ' '){
+                        continue;
+                    }
+                    std::string white, black;
+                    for(int j = 0; j < layout.n; j++){
+                        if(j == captured){
+                            continue;
+                        }
+                        char piece = layout.piece[j];
+                        if(j == i && promotion != ' '){
+                            piece = is_upper(piece) ? promotion : tolower(promotion);
+                        }
+                        (is_upper(piece) ? white : black) += piece;
+                    }
+                    if(white.length() + black.length() >= 3){
+                        bool flipped;
+                        result.insert(get_signature(white, black, &flipped));
+                    }
+                }
+            }
+        }
+        return std::vector<std::string>(result.begin(), result.end());
+    }
+
+    /**
+     * @brief Computes the values of the table by retrograde analysis. All dependencies have to be available.
+     *
+     * First all positions are generated: illegal ones are marked, mates are the first layer, moves leaving the table
+     * are looked up in the smaller tables. Each position gets a counter of its children (distinct indices).
+     * Then the layers are processed by the number of half-moves to mate: parents of lost positions are won,
+     * parents of won positions get their counter decreased and are lost when the counter reaches zero.
+     * Positions which were not reached are draws.
+     */
+    std::vector<uint8_t> compute_table(const Layout& layout){
+        std::vector<uint8_t> values(layout.size, INVALID_VALUE);
+        std::vector<uint8_t> counters(layout.size, 0);
+
+        // layers[n] are positions with mate in n half-moves, wins[n] are positions which can win in n half-moves by leaving the table,
+        // decrements[n] are positions which can leave the table to a position won in n half-moves by the opponent
+        std::vector<std::vector<uint32_t>> layers(INVALID_VALUE), wins(INVALID_VALUE), decrements(INVALID_VALUE);
+
+        Pieces children[MAX_CHILDREN];
+        bool exits[MAX_CHILDREN];
+        size_t indices[MAX_CHILDREN];
+        for(size_t index = 0; index < layout.size; index++){
+            Pieces position = get_position(layout, index);
+            bool valid = true;
+            for(int i = 0; i < layout.n; i++){
+                for(int j = 0; j < i; j++){
+                    valid = valid && position.square[i] != position.square[j];
+                }
+                valid = valid && (toupper(position.piece[i]) != 'P' || (position.square[i] / 8 != 0 && position.square[i] / 8 != 7));
+            }
+            if(!valid || get_index(layout, position) != index || in_check(position, !position.white_to_move)){
+                continue;
+            }
+            values[index] = DRAW_VALUE;
+            int count = get_children(position, children, exits);
+            if(count == 0){
+                if(in_check(position, position.white_to_move)){
+                    // mate
+                    values[index] = 1;
+                    layers[0].push_back(index);
+                }
+                continue;
+            }
+            int inside = 0;
+            int outside = 0;
+            for(int i = 0; i < count; i++){
+                if(!exits[i]){
+                    indices[inside++] = get_index(layout, children[i]);
+                    continue;
+                }
+                outside++;
+                uint8_t value;
+                if(!lookup(children[i], &value)){
+                    throw "missing tablebase dependency";
+                }
+                if(value != DRAW_VALUE && (value - 1) % 2 == 0){
+                    // the opponent gets mated
+                    wins[value].push_back(index);
+                } else if(value != DRAW_VALUE){
+                    decrements[value - 1].push_back(index);
+                }
+            }
+            std::sort(indices, indices + inside);
+            counters[index] = (std::unique(indices, indices + inside) - indices) + outside;
+        }
+
+        // decreases the counter of the position, whose child is won in n half-moves by the opponent
+        auto decrement = [&](size_t index, int n){
+            if(values[index] == DRAW_VALUE && --counters[index] == 0){
+                values[index] = n + 2;
+                layers[n + 1].push_back(index);
+            }
+        };
+
+        Pieces parents[MAX_CHILDREN];
+        for(int n = 0; n + 2 < INVALID_VALUE; n++){
+            if(n % 2 == 1){
+                for(auto index : wins[n]){
+                    if(values[index] == DRAW_VALUE){
+                        values[index] = n + 1;
+                        layers[n].push_back(index);
+                    }
+                }
+                for(auto index : decrements[n]){
+                    decrement(index, n);
+                }
+            }
+            for(size_t k = 0; k < layers[n].size(); k++){
+                int count = get_parents(get_position(layout, layers[n][k]), parents);
+                for(int i = 0; i < count; i++){
+                    indices[i] = get_index(layout, parents[i]);
+                }
+                std::sort(indices, indices + count);
+                count = std::unique(indices, indices + count) - indices;
+                for(int i = 0; i < count; i++){
+                    if(values[indices[i]] != DRAW_VALUE){
+                        // resolved or illegal
+                        continue;
+                    }
+                    if(n % 2 == 0){
+                        values[indices[i]] = n + 2;
+                        layers[n + 1].push_back(indices[i]);
+                    } else {
+                        decrement(indices[i], n);
+                    }
+                }
+            }
+            layers[n] = std::vector<uint32_t>();
+        }
+        if(!layers[INVALID_VALUE - 2].empty()){
+            throw "mate is too long for the tablebase";
+        }
+        return values;
+    }
+
+    // makes the table available for Tablebase::lookup
+    void add_material(const Table* table){
+        int key = get_material_key(table->layout.piece, table->layout.n);
+        // the material with colors swapped (for equal sides it is the same key, which is not flipped)
+        materials[(key % SIDE_KEYS) * SIDE_KEYS + key / SIDE_KEYS] = {table, true};
+        materials[key] = {table, false};
+    }
+
+    // returns path of the table file
+    std::string get_path(const std::string& directory, const std::string& signature){
+        return directory + "/" + signature + ".dtm";
+    }
+
+    /**
+     * @brief memory-maps all tables found in the directory (files named "<signature>.dtm")
+     *
+     * @return number of loaded tables
+     * @throws const char* if a table file is corrupted
+     */
+    int load(const std::string& directory){
+        int loaded = 0;
+        for(auto& signature : all_signatures()){
+            if(tables.count(signature) > 0){
+                continue;
+            }
+            int fd = open(get_path(directory, signature).c_str(), O_RDONLY);
+            if(fd < 0){
+                continue;
+            }
+            Layout layout = get_layout(signature);
+            struct stat info;
+            if(fstat(fd, &info) != 0 || (size_t)info.st_size != HEADER_SIZE + layout.size){
+                close(fd);
+                throw "corrupted tablebase file";
+            }
+            void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if(mapping == MAP_FAILED){
+                throw "cannot map tablebase file";
+            }
+            const uint8_t* data = (const uint8_t*)mapping;
+            if(memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0){
+                munmap(mapping, info.st_size);
+                throw "corrupted tablebase file";
+            }
+            // the mapping lives until the end of the program
+            tables[signature] = {layout, data + HEADER_SIZE, std::vector<uint8_t>()};
+            add_material(&tables[signature]);
+            loaded++;
+        }
+        return loaded;
+    }
+
+    /**
+     * @brief Builds the table of given signature by retrograde analysis and saves it into the directory.
+     * Tables needed for the positions after captures and promotions are loaded or built (and saved) first.
+     * The built tables are available for probing immediately.
+     *
+     * @throws const char* if the signature is not supported or the file cannot be written
+     */
+    void build(const std::string& signature, const std::string& directory, bool verbose){
+        if(tables.count(signature) > 0){
+            return;
+        }
+        Layout layout = get_layout(signature);
+        for(auto& dependency : get_dependencies(layout)){
+            build(dependency, directory, verbose);
+        }
+        if(verbose){
+            std::cout << "Building " << signature << "..." << std::flush;
+        }
+        std::vector<uint8_t> values = compute_table(layout);
+        Table& table = tables[signature];
+        table.layout = layout;
+        table.memory = std::move(values);
+        table.data = table.memory.data();
+        add_material(&table);
+
+        std::ofstream file(get_path(directory, signature), std::ios::binary);
+        char header[HEADER_SIZE] = {};
+        memcpy(header, FILE_MAGIC, sizeof(FILE_MAGIC));
+        uint32_t size = layout.size;
+        memcpy(header + sizeof(FILE_MAGIC), &size, sizeof(size));
+        file.write(header, HEADER_SIZE);
+        file.write((const char*)table.data, layout.size);
+        if(!file){
+            throw "cannot write tablebase file";
+        }
+        if(verbose){
+            std::cout << "done!" << std::endl;
+        }
+    }
+
+    /**
+     * @brief Looks the position up in the loaded tables.
+     *
+     * @param plies set to the number of half-moves to mate for Result::WIN and Result::LOSS
+     */
+    Result probe(Position* position, int* plies){
+        int n = position->m_pieces.size();
+        if(n > MAX_PIECES || n < 3 || tables.empty()){
+            return Result::UNKNOWN;
+        }
+        Pieces pieces;
+        pieces.n = 2;
+        pieces.white_to_move = position->m_to_move == 'w';
+        for(auto& piece : position->m_pieces){
+            int i = piece.first == 'K' ? 0 : (piece.first == 'k' ? 1 : pieces.n++);
+            pieces.piece[i] = piece.first;
+            pieces.square[i] = piece.second;
+        }
+        uint8_t value;
+        if(!lookup(pieces, &value) || value == INVALID_VALUE){
+            return Result::UNKNOWN;
+        }
+        if(value == DRAW_VALUE){
+            return Result::DRAW;
+        }
+        *plies = value - 1;
+        return *plies % 2 == 1 ? Result::WIN : Result::LOSS;
+    }
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "position.h"
+#include <string>
+#include <vector>
+
+/**
+ * @brief Endgame tablebases for positions with 3 and 4 pieces (including kings).
+ *
+ * Each table stores distance to mate (in half-moves) of every position with given material (e.g. "KQvKR"), one byte
+ * per position. Tables are built by retrograde analysis and saved to files, which are memory-mapped when loaded,
+ * so they are shared between processes and cost no loading time.
+ *
+ * Tables in which both sides have pawns are not supported (they would need en-passant in the index).
+ * Like the rest of the program the tables ignore castles, they also ignore the fifty-move rule.
+ */
+namespace Tablebase{
+
+    // Maximal number of pieces (including kings) of the supported tables
+    const int MAX_PIECES = 4;
+
+    /**
+     * @brief Result of the probe from the point of view of the player to move
+     *
+     */
+    enum class Result{
+        UNKNOWN, // the table is not loaded (or the material is not supported)
+        DRAW,
+        WIN,     // the player to move mates in given number of half-moves
+        LOSS     // the player to move gets mated in given number of half-moves
+    };
+
+    /**
+     * @brief returns all supported material signatures (e.g. "KRvK", "KQvKR"), the stronger side is always first
+     */
+    std::vector<std::string> all_signatures();
+
+    /**
+     * @brief memory-maps all tables found in the directory (files named "<signature>.dtm")
+     *
+     * @return number of loaded tables
+     * @throws const char* if a table file is corrupted
+     */
+    int load(const std::string& directory);
+
+    /**
+     * @brief Builds the table of given signature by retrograde analysis and saves it into the directory.
+     * Tables needed for the positions after captures and promotions are loaded or built (and saved) first.
+     * The built tables are available for probing immediately.
+     *
+     * @throws const char* if the signature is not supported or the file cannot be written
+     */
+    void build(const std::string& signature, const std::string& directory, bool verbose=true);
+
+    /**
+     * @brief Looks the position up in the loaded tables.
+     *
+     * @param plies set to the number of half-moves to mate for Result::WIN and Result::LOSS
+     */
+    Result probe(Position* position, int* plies);
+
+}